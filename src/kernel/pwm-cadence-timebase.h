@@ -0,0 +1,169 @@
+/* pwm-cadence-timebase.h
+ *
+ * Conversion between ns and counter clock ticks for the Cadence Triple Timer
+ * Counter (TTC) PWM driver. Kept apart from the driver so that the userspace
+ * check in src/tools can compare it against exact division.
+ *
+ * Copyright (C) 2015 Xiphos Systems Corporation.
+ * Copyright (C) 2021 Fastree3D
+ * Licensed under the GPL-2 or later.
+ */
+
+#ifndef _PWM_CADENCE_TIMEBASE_H
+#define _PWM_CADENCE_TIMEBASE_H
+
+/* Outside the kernel, the includer provides the types and math64 helpers */
+#ifdef __KERNEL__
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#endif
+
+#include "pwm-cadence.h"
+
+#define CPWM_NSEC_PER_SEC 1000000000U
+#define CPWM_MAX_PRESCALER (CPWM_NUM_PRESCALERS - 1)
+
+/* Conversion from ns to ticks of a counter clock, ticks being approximately
+ * (ns * mult) >> (shift + post_shift), or (ns * mult64) >> shift64 for counters
+ * wider than 16 bits. ns_to_clocks is the one of the two the counter width
+ * needs, picked by cpwm_timebase_set(). A period fits the counter with
+ * prescaler p while it is below period_limit_ns[p]. */
+struct cadence_pwm_timebase {
+	u32 rate;
+	u32 mult;
+	u32 shift; // at most 32, as mul_u64_u32_shr() takes
+	u32 post_shift;
+	u32 counter_bits; // set once, before the rate
+	u64 mult64;
+	u32 shift64;
+	u64 (*ns_to_clocks)(const struct cadence_pwm_timebase *tb, u64 ns);
+	u64 period_limit_ns[CPWM_MAX_PRESCALER + 1];
+};
+
+/* Rounded up, so that the ns reported for a counter value convert back to the
+ * same value. Saturates, as 2^48 ticks of a slow clock do not fit. */
+static inline u64 cpwm_ticks_to_ns(const struct cadence_pwm_timebase *tb,
+				   u64 ticks)
+{
+	u64 q, rem;
+
+	if (!tb->rate)
+		return 0;
+
+	q = div64_u64_rem(ticks, tb->rate, &rem);
+	if (q >= div_u64(U64_MAX, CPWM_NSEC_PER_SEC))
+		return U64_MAX;
+
+	return q * CPWM_NSEC_PER_SEC +
+	       DIV64_U64_ROUND_UP(rem * CPWM_NSEC_PER_SEC, tb->rate);
+}
+
+/* Shifting the floor of the product further is exact */
+static inline u64 cpwm_ns_to_clocks_16(const struct cadence_pwm_timebase *tb,
+				       u64 ns)
+{
+	return mul_u64_u32_shr(ns, tb->mult, tb->shift) >> tb->post_shift;
+}
+
+static inline u64 cpwm_ns_to_clocks_32(const struct cadence_pwm_timebase *tb,
+				       u64 ns)
+{
+	return mul_u64_u64_shr(ns, tb->mult64, tb->shift64);
+}
+
+/* Like clocks_calc_mult_shift(), but with mult normalized to 32 bits rather
+ * than the shift capped at 32. mult is rounded once, so its relative error
+ * stays within 2^-32 and the product within one tick over the whole 2^32 tick
+ * range of a 16 bit counter at any clock rate. A 32 bit counter spans 2^48
+ * ticks, which takes the 64 bit mult64: rate * 2^64 / NSEC_PER_SEC, computed
+ * by long division and shifted right just enough to fit. */
+static inline void cpwm_timebase_set(struct cadence_pwm_timebase *tb,
+				     unsigned long rate)
+{
+	u32 shift = 32, rem;
+	u64 mult, hi, lo;
+	int k, p;
+
+	mult = div_u64_rem((u64)rate << 32, CPWM_NSEC_PER_SEC, &rem);
+	if (mult >> 32) {
+		/* 1 GHz and above */
+		k = fls(mult >> 32);
+		mult = div_u64(((u64)rate << (32 - k)) + CPWM_NSEC_PER_SEC / 2,
+			       CPWM_NSEC_PER_SEC);
+		shift -= k;
+	} else if (mult && mult < BIT(31)) {
+		k = 31 - ilog2(mult);
+		mult = (mult << k) + div_u64(((u64)rem << k) +
+						     CPWM_NSEC_PER_SEC / 2,
+					     CPWM_NSEC_PER_SEC);
+		shift += k;
+	} else if (rem >= CPWM_NSEC_PER_SEC / 2)
+		mult++;
+
+	/* Rounding up can only carry to exactly 2^32 */
+	if (mult >> 32) {
+		mult >>= 1;
+		shift--;
+	}
+
+	tb->rate = rate;
+	tb->mult = mult;
+	tb->shift = shift > 32 ? 32 : shift;
+	tb->post_shift = shift - tb->shift;
+
+	tb->ns_to_clocks = cpwm_ns_to_clocks_16;
+	if (tb->counter_bits > 16) {
+		hi = div_u64_rem((u64)rate << 32, CPWM_NSEC_PER_SEC, &rem);
+		lo = div_u64((u64)rem << 32, CPWM_NSEC_PER_SEC);
+		k = hi >> 32 ? fls(hi >> 32) : 0;
+		tb->mult64 = (hi << (32 - k)) | (lo >> k);
+		tb->shift64 = 64 - k;
+		tb->ns_to_clocks = cpwm_ns_to_clocks_32;
+	}
+
+	for (p = 0; p <= CPWM_MAX_PRESCALER; p++)
+		tb->period_limit_ns[p] =
+			cpwm_ticks_to_ns(tb, BIT_ULL(tb->counter_bits + p));
+}
+
+/* The grid of periods and duty cycles a prescaler can produce contains the
+ * grids of all larger prescalers, so the smallest prescaler the period fits
+ * in also gives the smallest combined period and duty error. Found without
+ * converting to ticks or dividing. */
+static inline int cpwm_prescaler(const struct cadence_pwm_timebase *tb,
+				 u64 period_ns)
+{
+	int p;
+
+	for (p = 0; p < CPWM_MAX_PRESCALER; p++)
+		if (period_ns < tb->period_limit_ns[p])
+			break;
+
+	return p;
+}
+
+/* floor(ns * rate / NSEC_PER_SEC) without a division, the remainder being
+ * stored in *rem. As mult is rounded, the multiplication can be one tick off.
+ * The remainder of the exact division is below 2^32, so the low 32 bits of
+ * ns * rate - ticks * NSEC_PER_SEC tell which way, and are cheap to compute. */
+static inline u64 cpwm_ns_to_ticks(const struct cadence_pwm_timebase *tb,
+				   u64 ns, u32 *rem)
+{
+	u64 ticks = tb->ns_to_clocks(tb, ns);
+
+	*rem = (u32)ns * tb->rate - (u32)ticks * CPWM_NSEC_PER_SEC;
+	if (*rem >= CPWM_NSEC_PER_SEC) {
+		if (*rem < 2 * CPWM_NSEC_PER_SEC) {
+			ticks++;
+			*rem -= CPWM_NSEC_PER_SEC;
+		} else {
+			ticks--;
+			*rem += CPWM_NSEC_PER_SEC;
+		}
+	}
+
+	return ticks;
+}
+
+#endif /* _PWM_CADENCE_TIMEBASE_H */
@@ -0,0 +1,137 @@
+/* pwm-cadence-trace.h
+ *
+ * Tracepoints for the Cadence Triple Timer Counter (TTC) PWM driver
+ *
+ * Copyright (C) 2015 Xiphos Systems Corporation.
+ * Copyright (C) 2021 Fastree3D
+ * Licensed under the GPL-2 or later.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pwm_cadence
+
+#if !defined(_PWM_CADENCE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PWM_CADENCE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* Keep in sync with enum cpwm_register */
+#define show_cpwm_register(reg)                                             \
+	__print_symbolic(reg, { 0, "CLK_CTRL" }, { 1, "COUNTER_CTRL" },    \
+			 { 2, "COUNTER_VALUE" }, { 3, "INTERVAL_COUNTER" }, \
+			 { 4, "MATCH_1_COUNTER" }, { 5, "MATCH_2_COUNTER" },  \
+			 { 6, "MATCH_3_COUNTER" },                          \
+			 { 7, "INTERRUPT_REGISTER" },                       \
+			 { 8, "INTERRUPT_ENABLE" },                         \
+			 { 9, "EVENT_CONTROL_TIMER" },                      \
+			 { 10, "EVENT_REGISTER" })
+
+DECLARE_EVENT_CLASS(cpwm_reg,
+
+	TP_PROTO(const void *cpwm, int pwm, int reg, u32 value),
+
+	TP_ARGS(cpwm, pwm, reg, value),
+
+	TP_STRUCT__entry(
+		__field(const void *, cpwm)
+		__field(int, pwm)
+		__field(int, reg)
+		__field(u32, value)
+	),
+
+	TP_fast_assign(
+		__entry->cpwm = cpwm;
+		__entry->pwm = pwm;
+		__entry->reg = reg;
+		__entry->value = value;
+	),
+
+	TP_printk("%p:%d %s=%08x", __entry->cpwm, __entry->pwm,
+		  show_cpwm_register(__entry->reg), __entry->value)
+);
+
+DEFINE_EVENT(cpwm_reg, cpwm_read,
+	TP_PROTO(const void *cpwm, int pwm, int reg, u32 value),
+	TP_ARGS(cpwm, pwm, reg, value)
+);
+
+DEFINE_EVENT(cpwm_reg, cpwm_write,
+	TP_PROTO(const void *cpwm, int pwm, int reg, u32 value),
+	TP_ARGS(cpwm, pwm, reg, value)
+);
+
+TRACE_EVENT(cpwm_config,
+
+	TP_PROTO(const void *cpwm, int pwm, u64 duty_ns, u64 period_ns,
+		 int prescaler, u64 duty_ticks, u64 period_ticks, u64 error,
+		 u32 rate),
+
+	TP_ARGS(cpwm, pwm, duty_ns, period_ns, prescaler, duty_ticks,
+		period_ticks, error, rate),
+
+	TP_STRUCT__entry(
+		__field(const void *, cpwm)
+		__field(int, pwm)
+		__field(u64, duty_ns)
+		__field(u64, period_ns)
+		__field(int, prescaler)
+		__field(u64, duty_ticks)
+		__field(u64, period_ticks)
+		__field(u64, error_ns)
+	),
+
+	TP_fast_assign(
+		__entry->cpwm = cpwm;
+		__entry->pwm = pwm;
+		__entry->duty_ns = duty_ns;
+		__entry->period_ns = period_ns;
+		__entry->prescaler = prescaler;
+		__entry->duty_ticks = duty_ticks;
+		__entry->period_ticks = period_ticks;
+		/* error is in ticks / NSEC_PER_SEC, divided only when tracing */
+		__entry->error_ns = div_u64(error, rate);
+	),
+
+	TP_printk("%p:%d %llu/%llu ns, %llu/%llu ticks, prescaler 2^%d, error %llu ns",
+		  __entry->cpwm, __entry->pwm, __entry->duty_ns,
+		  __entry->period_ns, __entry->duty_ticks,
+		  __entry->period_ticks, __entry->prescaler,
+		  __entry->error_ns)
+);
+
+DECLARE_EVENT_CLASS(cpwm_pwm,
+
+	TP_PROTO(const void *cpwm, int pwm),
+
+	TP_ARGS(cpwm, pwm),
+
+	TP_STRUCT__entry(
+		__field(const void *, cpwm)
+		__field(int, pwm)
+	),
+
+	TP_fast_assign(
+		__entry->cpwm = cpwm;
+		__entry->pwm = pwm;
+	),
+
+	TP_printk("%p:%d", __entry->cpwm, __entry->pwm)
+);
+
+DEFINE_EVENT(cpwm_pwm, cpwm_enable,
+	TP_PROTO(const void *cpwm, int pwm),
+	TP_ARGS(cpwm, pwm)
+);
+
+DEFINE_EVENT(cpwm_pwm, cpwm_disable,
+	TP_PROTO(const void *cpwm, int pwm),
+	TP_ARGS(cpwm, pwm)
+);
+
+#endif /* _PWM_CADENCE_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pwm-cadence-trace
+#include <trace/define_trace.h>
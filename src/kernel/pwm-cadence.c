@@ -18,44 +18,48 @@
  */
 
 #include <linux/clk.h>
+#include <linux/debugfs.h>
+#include <linux/hash.h>
+#include <linux/interrupt.h>
 #include <linux/module.h>
 #include <linux/io.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
 #include <linux/pwm.h>
 #include <linux/of_address.h>
 #include <linux/of_device.h>
+#include <linux/regmap.h>
+#include <linux/sched/clock.h>
+#include <linux/seq_file.h>
+#include <linux/timex.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 #include <asm/div64.h>
 
+#include "pwm-cadence.h"
+#include "pwm-cadence-timebase.h"
+
+#define CREATE_TRACE_POINTS
+#include "pwm-cadence-trace.h"
+
 #define DRIVER_NAME "pwm-cadence"
 
-/* Register description (from section 8.5) */
-
-enum cpwm_register {
-	CPWM_CLK_CTRL = 0,
-	CPWM_COUNTER_CTRL = 1,
-	CPWM_COUNTER_VALUE = 2,
-	CPWM_INTERVAL_COUNTER = 3,
-	CPWM_MATCH_1_COUNTER = 4,
-	CPWM_MATCH_2_COUNTER = 5,
-	CPWM_MATCH_3_COUNTER = 6,
-	CPWM_INTERRUPT_REGISTER = 7,
-	CPWM_INTERRUPT_ENABLE = 8,
-	CPWM_EVENT_CONTROL_TIMER = 9,
-	CPWM_EVENT_REGISTER = 10
-};
+static bool relaxed_mmio = true;
+module_param(relaxed_mmio, bool, 0444);
+MODULE_PARM_DESC(relaxed_mmio,
+		 "Issue register sequences with relaxed accessors and a single barrier (default: true)");
 
-static const char *cpwm_register_names[] = {
-	[CPWM_CLK_CTRL] = "CLK_CTRL",
-	[CPWM_COUNTER_CTRL] = "COUNTER_CTRL",
-	[CPWM_COUNTER_VALUE] = "COUNTER_VALUE",
-	[CPWM_INTERVAL_COUNTER] = "INTERVAL_COUNTER",
-	[CPWM_MATCH_1_COUNTER] = "MATCH_1_COUNTER",
-	[CPWM_MATCH_2_COUNTER] = "MATCH_2_COUNTER",
-	[CPWM_MATCH_3_COUNTER] = "MATCH_3_COUNTER",
-	[CPWM_INTERRUPT_REGISTER] = "INTERRUPT_REGISTER",
-	[CPWM_INTERRUPT_ENABLE] = "INTERRUPT_ENABLE",
-	[CPWM_EVENT_CONTROL_TIMER] = "EVENT_CONTROL_TIMER",
-	[CPWM_EVENT_REGISTER] = "EVENT_REGISTER",
-};
+static unsigned int mmio_log_size;
+module_param(mmio_log_size, uint, 0444);
+MODULE_PARM_DESC(mmio_log_size,
+		 "Number of register accesses kept in the debugfs mmio_log ring (default: 0, off)");
+
+/* Registers whose content is changed by the hardware itself. Everything else
+ * only ever holds what the driver wrote, so it can be served from the shadow
+ * copy in struct cadence_pwm_chip. INTERRUPT_REGISTER is clear-on-read. */
+#define CPWM_VOLATILE_REGISTERS                                             \
+	(BIT(CPWM_COUNTER_VALUE) | BIT(CPWM_INTERRUPT_REGISTER) |           \
+	 BIT(CPWM_EVENT_REGISTER))
 
 #define CPWM_CLK_FALLING_EDGE 0x40
 #define CPWM_CLK_SRC_EXTERNAL 0x20
@@ -63,219 +67,2261 @@ static const char *cpwm_register_names[] = {
 #define CPWM_CLK_PRESCALE_MASK (15 << 1)
 #define CPWM_CLK_PRESCALE_ENABLE 1
 
-#define CPWM_COUNTER_CTRL_WAVE_POL 0x40
-#define CPWM_COUNTER_CTRL_WAVE_DISABLE 0x20
-#define CPWM_COUNTER_CTRL_RESET 0x10
-#define CPWM_COUNTER_CTRL_MATCH_ENABLE 0x8
-#define CPWM_COUNTER_CTRL_DECREMENT_ENABLE 0x4
-#define CPWM_COUNTER_CTRL_INTERVAL_ENABLE 0x2
-#define CPWM_COUNTER_CTRL_COUNTING_DISABLE 0x1
+#define CPWM_COUNTER_CTRL_WAVE_POL 0x40
+#define CPWM_COUNTER_CTRL_WAVE_DISABLE 0x20
+#define CPWM_COUNTER_CTRL_RESET 0x10
+#define CPWM_COUNTER_CTRL_MATCH_ENABLE 0x8
+#define CPWM_COUNTER_CTRL_DECREMENT_ENABLE 0x4
+#define CPWM_COUNTER_CTRL_INTERVAL_ENABLE 0x2
+#define CPWM_COUNTER_CTRL_COUNTING_DISABLE 0x1
+
+#define CPWM_INTERRUPT_INTERVAL 0x1
+
+#define CPWM_NUM_PWM 3
+
+/* Bits that trigger an action rather than hold state. They read back as zero,
+ * and writing them is never redundant. */
+static const uint32_t cpwm_strobe_bits[CPWM_NUM_REGISTERS] = {
+	[CPWM_COUNTER_CTRL] = CPWM_COUNTER_CTRL_RESET,
+};
+
+/* Register layout of a TTC integration: offsets[pwm][reg] is the offset of a
+ * register of one counter from the start of the block. The three counters of a
+ * register are contiguous when channel_stride is one word, which allows burst
+ * writes. */
+struct cadence_pwm_variant {
+	uint16_t offsets[CPWM_NUM_PWM][CPWM_NUM_REGISTERS];
+	bool contiguous;
+	unsigned int counter_bits; // if probe cannot tell, see cpwm_counter_bits()
+};
+
+#define CPWM_OFFSET(cs, rs, pwm, reg) ((pwm) * (cs) + (reg) * (rs))
+#define CPWM_CHANNEL_OFFSETS(cs, rs, pwm)                                    \
+	{                                                                    \
+		CPWM_OFFSET(cs, rs, pwm, 0), CPWM_OFFSET(cs, rs, pwm, 1),    \
+		CPWM_OFFSET(cs, rs, pwm, 2), CPWM_OFFSET(cs, rs, pwm, 3),    \
+		CPWM_OFFSET(cs, rs, pwm, 4), CPWM_OFFSET(cs, rs, pwm, 5),    \
+		CPWM_OFFSET(cs, rs, pwm, 6), CPWM_OFFSET(cs, rs, pwm, 7),    \
+		CPWM_OFFSET(cs, rs, pwm, 8), CPWM_OFFSET(cs, rs, pwm, 9),    \
+		CPWM_OFFSET(cs, rs, pwm, 10)                                 \
+	}
+#define CPWM_LAYOUT(channel_stride, register_stride)                         \
+	.offsets = {                                                         \
+		CPWM_CHANNEL_OFFSETS(channel_stride, register_stride, 0),    \
+		CPWM_CHANNEL_OFFSETS(channel_stride, register_stride, 1),    \
+		CPWM_CHANNEL_OFFSETS(channel_stride, register_stride, 2),    \
+	},                                                                   \
+	.contiguous = (channel_stride) == 4
+
+/* Zynq-7000: the three counters of a register are interleaved [UG585] */
+static const struct cadence_pwm_variant cadence_pwm_zynq = {
+	CPWM_LAYOUT(4, 4 * CPWM_NUM_PWM),
+	.counter_bits = 16,
+};
+
+/* Zynq UltraScale+ and Versal: same layout, 32 bit counters */
+static const struct cadence_pwm_variant cadence_pwm_zynqmp = {
+	CPWM_LAYOUT(4, 4 * CPWM_NUM_PWM),
+	.counter_bits = 32,
+};
+
+/* For PWM operation, we want "interval mode" where "Interval mode: The counter
+increments or decrements continuously between 0 and the value of the Interval
+register, with the direction of counting determined by the DEC bit of the
+Counter Control register. An interval interrupt is generated when the counter
+passes through zero. The corresponding match interrupt is generated when the
+counter value equals one of the Match registers." [UG585] */
+
+struct cadence_pwm_stats {
+	u64 reads_issued; // register reads that reached the bus
+	u64 reads_avoided; // register reads served from the shadow copy
+	u64 writes_issued[CPWM_NUM_REGISTERS]; // register writes sent to the bus
+	u64 writes_elided[CPWM_NUM_REGISTERS]; // redundant writes dropped
+};
+
+enum cpwm_op {
+	CPWM_OP_CONFIG,
+	CPWM_OP_ENABLE,
+	CPWM_OP_DISABLE,
+	CPWM_NUM_OPS
+};
+
+static const char *const cpwm_op_names[] = {
+	[CPWM_OP_CONFIG] = "config",
+	[CPWM_OP_ENABLE] = "enable",
+	[CPWM_OP_DISABLE] = "disable",
+};
+
+#define CPWM_HIST_BUCKETS 32
+
+/* Cost of a PWM operation; bucket i counts calls that took [2^i, 2^(i+1))
+ * cycles, with bucket 0 also holding calls below one cycle. */
+struct cadence_pwm_hist {
+	u64 calls;
+	u64 mmio_ops; // bus accesses over all calls
+	u64 mmio_ops_max; // most bus accesses in one call
+	u64 buckets[CPWM_HIST_BUCKETS];
+};
+
+/* How a period or duty cycle between two counter values is rounded */
+enum cpwm_rounding {
+	CPWM_ROUND_FLOOR,
+	CPWM_ROUND_NEAREST,
+	CPWM_ROUND_CEIL,
+	CPWM_NUM_ROUNDINGS
+};
+
+static const char *const cpwm_rounding_names[] = {
+	[CPWM_ROUND_FLOOR] = "floor",
+	[CPWM_ROUND_NEAREST] = "nearest",
+	[CPWM_ROUND_CEIL] = "ceil",
+};
+
+#define CPWM_MEMO_BITS 3
+
+/* Register values computed for a request, with what the trace event reports
+ * about them. Only valid while gen matches the counter's memo_gen. */
+struct cadence_pwm_memo {
+	u64 period_ns;
+	u64 duty_ns;
+	u64 period_ticks;
+	u64 duty_ticks;
+	u64 error; // of period and duty cycle, in ticks / NSEC_PER_SEC
+	u32 interval;
+	u32 match;
+	u32 match_floor; // the duty cycle is match_floor + duty_frac / 2^16
+	u32 duty_frac; // only computed for counters that dither
+	u32 duty_rem;
+	u32 gen;
+	int prescaler;
+	bool external; // counts clk rather than system_clk
+};
+
+/* Rate of the dedicated clock found best for a period */
+struct cadence_pwm_rate_memo {
+	u64 period_ns;
+	unsigned long rate; // 0 when unused
+	enum cpwm_rounding rounding; // the search was done with
+};
+
+struct cadence_pwm_chip;
+
+struct cadence_pwm_pwm {
+	struct cadence_pwm_chip *cpwm; // owner
+	struct clk *clk; // associated clock
+	struct cadence_pwm_timebase tb; // of clk, kept current by clk_nb
+	struct notifier_block clk_nb;
+	bool useExternalClk; // clk is a dedicated clock, not system_clk
+	bool clk_enabled; // clk held for the enabled output
+	bool exact_period; // clk rate is negotiated for each period
+	bool own_rate_change; // config is setting the rate, and reprograms next
+	int irq; // of the counter, 0 if none
+	bool dither; // fractional duty cycles are dithered
+	u32 dither_match; // MATCH_1 is dither_match or dither_match + 1
+	u32 dither_frac; // 16 bit fraction added to dither_acc every period
+	u32 dither_acc;
+	bool match_pending; // pending_match waits for the interval interrupt
+	u32 pending_match;
+	enum pwm_polarity polarity;
+	enum cpwm_rounding rounding;
+	struct cadence_pwm_stats stats;
+	bool posted; // relaxed writes not yet flushed to the device
+	u64 mmio_ops; // bus accesses so far, including flushes
+	struct cadence_pwm_hist hist[CPWM_NUM_OPS];
+	/* Direct-mapped on the request. Bumping memo_gen invalidates all. */
+	struct cadence_pwm_memo memo[1 << CPWM_MEMO_BITS];
+	u32 memo_gen;
+	u64 memo_hits;
+	u64 memo_misses;
+	u64 duty_updates; // configs that only had to write MATCH_1
+	struct cadence_pwm_rate_memo rate_memo[1 << CPWM_MEMO_BITS];
+	u64 period_ns; // last request, clamped, for clock rate changes
+	u64 duty_ns;
+};
+
+/* Reprogramming of the running counters after clock rate changes */
+struct cadence_pwm_retime {
+	u64 count;
+	u64 last_ns; // POST_RATE_CHANGE to counters reprogrammed
+	u64 max_ns;
+	u64 window_ns; // PRE_RATE_CHANGE to counters reprogrammed, last change
+	u64 pre_ns; // local_clock() at the last PRE_RATE_CHANGE
+};
+
+/* Ring of the last register accesses. Writers claim a slot by bumping head,
+ * so logging never takes a lock; a reader racing with a wrap can see a
+ * record being overwritten. */
+struct cadence_pwm_log {
+	struct cpwm_log_record *records;
+	unsigned int mask; // number of records - 1
+	atomic_t head; // number of records ever logged
+};
+
+/* Cost of the config register sequence, measured through debugfs */
+struct cadence_pwm_bench {
+	bool running;
+	int pwm;
+	u64 strict_cycles;
+	u64 relaxed_cycles;
+};
+
+struct cadence_pwm_chip {
+	struct pwm_chip chip;
+	uint32_t hwaddr;
+	char __iomem *base;
+	struct clk *system_clk;
+	struct cadence_pwm_timebase system_tb; // of system_clk
+	struct notifier_block system_clk_nb;
+	/* Serializes programming the counters against clock rate changes */
+	spinlock_t lock;
+	struct cadence_pwm_retime retime;
+	struct cadence_pwm_pwm pwms[CPWM_NUM_PWM];
+	const struct cadence_pwm_variant *variant;
+	unsigned int counter_bits; // as found by probe
+	struct miscdevice miscdev;
+#ifdef CONFIG_PWM_CADENCE_REGMAP
+	struct regmap *regmap;
+	u16 *regmap_regs; // BIT(reg) of the register at each word, 0 if none
+	unsigned int regmap_words;
+#else
+	uint32_t shadow[CPWM_NUM_REGISTERS][CPWM_NUM_PWM]; // hardware layout
+	struct cadence_pwm_log log;
+	struct cadence_pwm_bench bench;
+#endif
+	bool relaxed; // use relaxed accessors, see cpwm_flush()
+	struct dentry *debugfs;
+};
+
+static struct dentry *cadence_pwm_debugfs_root;
+
+static inline struct cadence_pwm_chip *cadence_pwm_get(struct pwm_chip *chip)
+{
+	return container_of(chip, struct cadence_pwm_chip, chip);
+}
+
+static inline unsigned int cpwm_register_offset(struct cadence_pwm_chip *cpwm,
+						int pwm, enum cpwm_register reg)
+{
+	return cpwm->variant->offsets[pwm][reg];
+}
+
+static inline volatile __iomem uint32_t *
+cpwm_register_address(struct cadence_pwm_chip *cpwm, int pwm,
+		      enum cpwm_register reg)
+{
+	return (uint32_t *)(cpwm_register_offset(cpwm, pwm, reg) +
+			    (char *)cpwm->base);
+}
+
+static inline bool cpwm_register_volatile(enum cpwm_register reg)
+{
+	return CPWM_VOLATILE_REGISTERS & BIT(reg);
+}
+
+/* In relaxed mode, a register sequence is only ordered against the rest of
+ * the system once it is complete: one barrier, then one read back from the
+ * counter to make sure the posted writes reached the TTC. Called at the end of
+ * every PWM operation. */
+static void cpwm_flush(struct cadence_pwm_chip *cpwm, int pwm)
+{
+	if (!cpwm->pwms[pwm].posted)
+		return;
+
+	mb();
+	readl_relaxed(cpwm_register_address(cpwm, pwm, CPWM_COUNTER_CTRL));
+	cpwm->pwms[pwm].mmio_ops++;
+	cpwm->pwms[pwm].posted = false;
+}
+
+/* One read back flushes the posted writes of all three counters */
+static void cpwm_flush_all(struct cadence_pwm_chip *cpwm)
+{
+	int pwm;
+
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+		if (cpwm->pwms[pwm].posted)
+			break;
+	if (pwm == CPWM_NUM_PWM)
+		return;
+
+	mb();
+	readl_relaxed(cpwm_register_address(cpwm, 0, CPWM_COUNTER_CTRL));
+	cpwm->pwms[0].mmio_ops++;
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+		cpwm->pwms[pwm].posted = false;
+}
+
+#ifdef CONFIG_PWM_CADENCE_REGMAP
+
+/* regmap backend: the flat cache stands in for the shadow copy, and regmap
+ * provides the debugfs register dump and the access tracepoints. */
+
+/* Whether offset belongs to one of the registers in the regs bitmap. regmap
+ * asks on every access, so this is a lookup in the table cpwm_regs_init()
+ * builds from the variant's layout. */
+static bool cpwm_regmap_offset_in(struct device *dev, unsigned int offset,
+				  unsigned long regs)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+
+	return offset / 4 < cpwm->regmap_words &&
+	       (regs & cpwm->regmap_regs[offset / 4]);
+}
+
+static bool cpwm_regmap_readable_reg(struct device *dev, unsigned int offset)
+{
+	return cpwm_regmap_offset_in(dev, offset,
+				     GENMASK(CPWM_NUM_REGISTERS - 1, 0));
+}
+
+static bool cpwm_regmap_volatile_reg(struct device *dev, unsigned int offset)
+{
+	return cpwm_regmap_offset_in(dev, offset, CPWM_VOLATILE_REGISTERS);
+}
+
+static bool cpwm_regmap_precious_reg(struct device *dev, unsigned int offset)
+{
+	return cpwm_regmap_offset_in(dev, offset,
+				     BIT(CPWM_INTERRUPT_REGISTER));
+}
+
+static const struct regmap_config cadence_pwm_regmap_config = {
+	.reg_bits = 32,
+	.val_bits = 32,
+	.reg_stride = 4,
+	.readable_reg = cpwm_regmap_readable_reg,
+	.writeable_reg = cpwm_regmap_readable_reg,
+	.volatile_reg = cpwm_regmap_volatile_reg,
+	.precious_reg = cpwm_regmap_precious_reg,
+	.cache_type = REGCACHE_FLAT,
+	.fast_io = true,
+};
+
+/* Strobe bits read back as zero from the hardware, but stay in the cache */
+static uint32_t cpwm_read(struct cadence_pwm_chip *cpwm, int pwm,
+			  enum cpwm_register reg)
+{
+	unsigned int x;
+
+	regmap_read(cpwm->regmap, cpwm_register_offset(cpwm, pwm, reg), &x);
+	if (cpwm_register_volatile(reg))
+		cpwm->pwms[pwm].mmio_ops++;
+	return x & ~cpwm_strobe_bits[reg];
+}
+
+/* regmap_update_bits() only reaches the bus when the value differs from the
+ * cached one, so strobe bits have to go through regmap_write(). */
+static void cpwm_write(struct cadence_pwm_chip *cpwm, int pwm,
+		       enum cpwm_register reg, uint32_t value)
+{
+	unsigned int offset = cpwm_register_offset(cpwm, pwm, reg);
+
+	if (value & cpwm_strobe_bits[reg])
+		regmap_write(cpwm->regmap, offset, value);
+	else
+		regmap_update_bits(cpwm->regmap, offset, ~0U, value);
+	/* An upper bound: regmap does not tell whether the write was dropped */
+	cpwm->pwms[pwm].mmio_ops++;
+
+	if (cpwm->relaxed)
+		cpwm->pwms[pwm].posted = true;
+}
+
+static void cpwm_write_all(struct cadence_pwm_chip *cpwm,
+			   enum cpwm_register reg,
+			   const uint32_t values[CPWM_NUM_PWM])
+{
+	int pwm;
+
+	if (cpwm->variant->contiguous)
+		regmap_bulk_write(cpwm->regmap,
+				  cpwm_register_offset(cpwm, 0, reg), values,
+				  CPWM_NUM_PWM);
+	else
+		for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+			regmap_write(cpwm->regmap,
+				     cpwm_register_offset(cpwm, pwm, reg),
+				     values[pwm]);
+
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++) {
+		cpwm->pwms[pwm].mmio_ops++;
+		if (cpwm->relaxed)
+			cpwm->pwms[pwm].posted = true;
+	}
+}
+
+static int cpwm_regs_init(struct cadence_pwm_chip *cpwm)
+{
+	struct regmap_config config = cadence_pwm_regmap_config;
+	unsigned int offset;
+	int pwm, reg;
+
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+		for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++)
+			config.max_register =
+				max_t(unsigned int, config.max_register,
+				      cpwm_register_offset(cpwm, pwm, reg));
+
+	cpwm->regmap_words = config.max_register / 4 + 1;
+	cpwm->regmap_regs = devm_kcalloc(cpwm->chip.dev, cpwm->regmap_words,
+					 sizeof(*cpwm->regmap_regs),
+					 GFP_KERNEL);
+	if (!cpwm->regmap_regs)
+		return -ENOMEM;
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+		for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++) {
+			offset = cpwm_register_offset(cpwm, pwm, reg);
+			cpwm->regmap_regs[offset / 4] = BIT(reg);
+		}
+
+	/* Seed the cache from the hardware, e.g. whatever the boot loader left */
+	config.num_reg_defaults_raw = cpwm->regmap_words;
+	config.use_relaxed_mmio = cpwm->relaxed;
+	cpwm->regmap = devm_regmap_init_mmio(cpwm->chip.dev, cpwm->base,
+					     &config);
+	return PTR_ERR_OR_ZERO(cpwm->regmap);
+}
+
+static void cpwm_regs_suspend(struct cadence_pwm_chip *cpwm)
+{
+	regcache_cache_only(cpwm->regmap, true);
+}
+
+/* The cache was seeded from the hardware, so regcache_sync() after
+ * regcache_mark_dirty() would skip every register still holding what the boot
+ * loader left. Every register is written back from the cache instead, counter
+ * settings first, so that no counter restarts with its reset interval before
+ * the control registers are restored. */
+static int cpwm_regs_resume(struct cadence_pwm_chip *cpwm)
+{
+	unsigned int offset, x;
+	int i, pwm, reg, ret = 0;
+
+	regcache_cache_only(cpwm->regmap, false);
+	for (i = 0; i < CPWM_NUM_REGISTERS && !ret; i++) {
+		/* INTERVAL_COUNTER to EVENT_REGISTER, then CLK_CTRL and
+		 * COUNTER_CTRL */
+		reg = (CPWM_INTERVAL_COUNTER + i) % CPWM_NUM_REGISTERS;
+		if (cpwm_register_volatile(reg))
+			continue;
+
+		for (pwm = 0; pwm < CPWM_NUM_PWM && !ret; pwm++) {
+			offset = cpwm_register_offset(cpwm, pwm, reg);
+			ret = regmap_read(cpwm->regmap, offset, &x);
+			if (ret)
+				break;
+			regcache_cache_bypass(cpwm->regmap, true);
+			ret = regmap_write(cpwm->regmap, offset, x);
+			regcache_cache_bypass(cpwm->regmap, false);
+		}
+	}
+	return ret;
+}
+
+#else /* CONFIG_PWM_CADENCE_REGMAP */
+
+static void cpwm_log(struct cadence_pwm_chip *cpwm, int pwm,
+		     enum cpwm_register reg, uint32_t value, u8 flags)
+{
+	struct cpwm_log_record *rec;
+	unsigned int slot;
+
+	if (likely(!cpwm->log.records))
+		return;
+
+	slot = atomic_inc_return(&cpwm->log.head) - 1;
+	rec = &cpwm->log.records[slot & cpwm->log.mask];
+	rec->timestamp = local_clock();
+	rec->value = value;
+	rec->pwm = pwm;
+	rec->reg = reg;
+	rec->flags = flags;
+}
+
+static inline uint32_t cpwm_mmio_read(struct cadence_pwm_chip *cpwm, int pwm,
+				      enum cpwm_register reg)
+{
+	uint32_t x;
+
+	if (cpwm->relaxed)
+		x = readl_relaxed(cpwm_register_address(cpwm, pwm, reg));
+	else
+		x = ioread32(cpwm_register_address(cpwm, pwm, reg));
+	cpwm->pwms[pwm].mmio_ops++;
+	cpwm_log(cpwm, pwm, reg, x, 0);
+	return x;
+}
+
+static inline void cpwm_mmio_write(struct cadence_pwm_chip *cpwm, int pwm,
+				   enum cpwm_register reg, uint32_t value)
+{
+	if (cpwm->relaxed) {
+		writel_relaxed(value, cpwm_register_address(cpwm, pwm, reg));
+		cpwm->pwms[pwm].posted = true;
+	} else
+		iowrite32(value, cpwm_register_address(cpwm, pwm, reg));
+	cpwm->pwms[pwm].mmio_ops++;
+	cpwm_log(cpwm, pwm, reg, value, CPWM_LOG_WRITE);
+}
+
+/* Non-volatile registers are served from the shadow copy, which saves an
+ * uncached bus round trip on every read-modify-write sequence. */
+static uint32_t cpwm_read(struct cadence_pwm_chip *cpwm, int pwm,
+			  enum cpwm_register reg)
+{
+	uint32_t x;
+
+	if (!cpwm_register_volatile(reg)) {
+		cpwm->pwms[pwm].stats.reads_avoided++;
+		return cpwm->shadow[reg][pwm];
+	}
+
+	x = cpwm_mmio_read(cpwm, pwm, reg);
+	cpwm->pwms[pwm].stats.reads_issued++;
+	trace_cpwm_read(cpwm, pwm, reg, x);
+	return x;
+}
+
+/* Writes that would store the value a non-volatile register already holds are
+ * dropped, unless they carry a strobe bit such as the counter reset. */
+static void cpwm_write(struct cadence_pwm_chip *cpwm, int pwm,
+		       enum cpwm_register reg, uint32_t value)
+{
+	if (!cpwm_register_volatile(reg) && !(value & cpwm_strobe_bits[reg]) &&
+	    value == cpwm->shadow[reg][pwm]) {
+		cpwm->pwms[pwm].stats.writes_elided[reg]++;
+		return;
+	}
+
+	trace_cpwm_write(cpwm, pwm, reg, value);
+	cpwm_mmio_write(cpwm, pwm, reg, value);
+	cpwm->pwms[pwm].stats.writes_issued[reg]++;
+
+	cpwm->shadow[reg][pwm] = value & ~cpwm_strobe_bits[reg];
+}
+
+/* Where a register of the three counters occupies three adjacent words, it is
+ * written with a single burst. */
+static void cpwm_mmio_write_all(struct cadence_pwm_chip *cpwm,
+				enum cpwm_register reg,
+				const uint32_t values[CPWM_NUM_PWM])
+{
+	int pwm;
+
+	if (cpwm->variant->contiguous)
+		__iowrite32_copy(cpwm->base +
+					 cpwm_register_offset(cpwm, 0, reg),
+				 values, CPWM_NUM_PWM);
+	else
+		for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+			writel_relaxed(values[pwm],
+				       cpwm_register_address(cpwm, pwm, reg));
+
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++) {
+		cpwm->pwms[pwm].posted = true;
+		cpwm->pwms[pwm].mmio_ops++;
+		cpwm_log(cpwm, pwm, reg, values[pwm], CPWM_LOG_WRITE);
+	}
+}
+
+/* Write a register of all three counters, unless none of them changes */
+static void cpwm_write_all(struct cadence_pwm_chip *cpwm,
+			   enum cpwm_register reg,
+			   const uint32_t values[CPWM_NUM_PWM])
+{
+	bool changed = cpwm_register_volatile(reg);
+	int pwm;
+
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+		if ((values[pwm] & cpwm_strobe_bits[reg]) ||
+		    values[pwm] != cpwm->shadow[reg][pwm])
+			changed = true;
+
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++) {
+		if (changed) {
+			cpwm->pwms[pwm].stats.writes_issued[reg]++;
+			trace_cpwm_write(cpwm, pwm, reg, values[pwm]);
+		} else
+			cpwm->pwms[pwm].stats.writes_elided[reg]++;
+	}
+	if (!changed)
+		return;
+
+	cpwm_mmio_write_all(cpwm, reg, values);
+
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+		cpwm->shadow[reg][pwm] = values[pwm] & ~cpwm_strobe_bits[reg];
+}
+
+/* Load the shadow copy from the hardware, e.g. whatever the boot loader left */
+static int cpwm_regs_init(struct cadence_pwm_chip *cpwm)
+{
+	int pwm, reg;
+
+	for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++)
+		for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+			if (!cpwm_register_volatile(reg))
+				cpwm->shadow[reg][pwm] =
+					cpwm_mmio_read(cpwm, pwm, reg);
+	return 0;
+}
+
+static void cpwm_regs_suspend(struct cadence_pwm_chip *cpwm)
+{
+}
+
+static void cpwm_log_init(struct cadence_pwm_chip *cpwm)
+{
+	unsigned int size;
+
+	if (!mmio_log_size)
+		return;
+
+	size = roundup_pow_of_two(mmio_log_size);
+	cpwm->log.records = devm_kcalloc(cpwm->chip.dev, size,
+					 sizeof(*cpwm->log.records),
+					 GFP_KERNEL);
+	if (!cpwm->log.records) {
+		dev_warn(cpwm->chip.dev, "no memory for %u log records", size);
+		return;
+	}
+	cpwm->log.mask = size - 1;
+}
+
+/* Write the whole shadow copy back, counter control last */
+static int cpwm_regs_resume(struct cadence_pwm_chip *cpwm)
+{
+	int reg;
+
+	for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++)
+		if (!cpwm_register_volatile(reg) && reg != CPWM_COUNTER_CTRL)
+			cpwm_mmio_write_all(cpwm, reg, cpwm->shadow[reg]);
+	cpwm_mmio_write_all(cpwm, CPWM_COUNTER_CTRL,
+			    cpwm->shadow[CPWM_COUNTER_CTRL]);
+	cpwm_flush_all(cpwm);
+	return 0;
+}
+
+#endif /* CONFIG_PWM_CADENCE_REGMAP */
+
+/* Rounds the exact tick count ticks + rem / NSEC_PER_SEC to a counter value,
+ * counting in units of 2^prescaler ticks */
+static u64 cpwm_round(u64 ticks, u32 rem, int prescaler,
+		      enum cpwm_rounding rounding)
+{
+	u64 low = ticks & (BIT_ULL(prescaler) - 1);
+	u64 value = ticks >> prescaler;
+
+	switch (rounding) {
+	case CPWM_ROUND_NEAREST:
+		if (low * CPWM_NSEC_PER_SEC + rem >=
+		    BIT_ULL(prescaler) * (CPWM_NSEC_PER_SEC / 2))
+			value++;
+		break;
+	case CPWM_ROUND_CEIL:
+		if (low || rem)
+			value++;
+		break;
+	default:
+		break;
+	}
+
+	return value;
+}
+
+/* Duration of 2^prescaler ticks, in ps */
+static u64 cpwm_tick_ps(const struct cadence_pwm_timebase *tb, int prescaler)
+{
+	if (!tb->rate)
+		return 0;
+
+	return DIV_ROUND_CLOSEST_ULL(1000ULL * CPWM_NSEC_PER_SEC << prescaler,
+				     tb->rate);
+}
+
+
+/* Account a PWM operation that started at cycle start, when the counter had
+ * done mmio_ops bus accesses */
+static void cpwm_hist_add(struct cadence_pwm_chip *cpwm, int pwm,
+			  enum cpwm_op op, cycles_t start, u64 mmio_ops)
+{
+	struct cadence_pwm_hist *hist = &cpwm->pwms[pwm].hist[op];
+	u64 cycles = get_cycles() - start;
+	int bucket = cycles ? ilog2(cycles) : 0;
+
+	mmio_ops = cpwm->pwms[pwm].mmio_ops - mmio_ops;
+
+	hist->calls++;
+	hist->buckets[min(bucket, CPWM_HIST_BUCKETS - 1)]++;
+	hist->mmio_ops += mmio_ops;
+	if (mmio_ops > hist->mmio_ops_max)
+		hist->mmio_ops_max = mmio_ops;
+}
+
+/* "If the waveform output mode is enabled, the waveform will change polarity
+ * when the count matches the value in the match 0 register." - [ttcps_v2_0]
+ */
+
+/* Clock control value x with the source and prescaler replaced */
+static uint32_t cpwm_clk_ctrl(uint32_t x, bool external, int prescaler)
+{
+	if (!prescaler)
+		x &= ~(CPWM_CLK_PRESCALE_ENABLE | CPWM_CLK_PRESCALE_MASK);
+	else {
+		x &= ~CPWM_CLK_PRESCALE_MASK;
+		x |= CPWM_CLK_PRESCALE_ENABLE |
+		     (((prescaler - 1) << CPWM_CLK_PRESCALE_SHIFT) &
+		      CPWM_CLK_PRESCALE_MASK);
+	};
+
+	if (external)
+		x |= CPWM_CLK_SRC_EXTERNAL;
+	else
+		x &= ~CPWM_CLK_SRC_EXTERNAL;
+
+	return x;
+}
+
+/* Turns the interval interrupt of counter h on or off. Its status latches
+ * every wrap even while it is off, and would raise the interrupt at once,
+ * mid-period, so it is read, which clears it, before turning it on. */
+static void cpwm_interval_irq(struct cadence_pwm_chip *cpwm, int h, bool on)
+{
+	if (on && !cpwm_read(cpwm, h, CPWM_INTERRUPT_ENABLE))
+		cpwm_read(cpwm, h, CPWM_INTERRUPT_REGISTER);
+	cpwm_write(cpwm, h, CPWM_INTERRUPT_ENABLE,
+		   on ? CPWM_INTERRUPT_INTERVAL : 0);
+}
+
+static void cpwm_program_counter(struct cadence_pwm_chip *cpwm, int h,
+				 bool external, int prescaler,
+				 uint32_t interval, uint32_t match)
+{
+	struct cadence_pwm_pwm *pwm = &cpwm->pwms[h];
+	uint32_t counter_ctrl, clk_ctrl, x, y;
+	bool running;
+
+	counter_ctrl = cpwm_read(cpwm, h, CPWM_COUNTER_CTRL);
+	clk_ctrl = cpwm_read(cpwm, h, CPWM_CLK_CTRL);
+
+	/* Clock control value */
+	x = cpwm_clk_ctrl(clk_ctrl, external, prescaler);
+
+	/* Counter control value, without the reset */
+	y = counter_ctrl & ~CPWM_COUNTER_CTRL_DECREMENT_ENABLE;
+	y |= CPWM_COUNTER_CTRL_INTERVAL_ENABLE | CPWM_COUNTER_CTRL_MATCH_ENABLE;
+
+	if (pwm->polarity == PWM_POLARITY_NORMAL)
+		y |= CPWM_COUNTER_CTRL_WAVE_POL;
+	else
+		y &= ~CPWM_COUNTER_CTRL_WAVE_POL;
+
+	/* Only the duty cycle changes: update it on the fly, the counter picks
+	 * it up without being stopped or restarted. Written at an arbitrary
+	 * point of the period, a match below the count that replaces one above
+	 * it leaves the period without its match edge. A running counter with
+	 * an interrupt therefore gets the new value from the interval
+	 * interrupt, just after it wrapped; that only misses when the new
+	 * match comes before the interrupt is served. A dithering counter
+	 * needs nothing deferred, the interrupt picks up the new dither values.
+	 * The same duty cycle applied again leaves everything as it was, its
+	 * MATCH_1 write elided. */
+	if (x == clk_ctrl && y == counter_ctrl &&
+	    cpwm_read(cpwm, h, CPWM_INTERVAL_COUNTER) == interval) {
+		running = pwm->irq &&
+			  !(counter_ctrl & CPWM_COUNTER_CTRL_COUNTING_DISABLE);
+		if (running && pwm->dither_frac) {
+			pwm->match_pending = false;
+			cpwm_interval_irq(cpwm, h, true);
+		} else if (running &&
+			   (pwm->match_pending ||
+			    match != cpwm_read(cpwm, h, CPWM_MATCH_1_COUNTER))) {
+			pwm->pending_match = match;
+			pwm->match_pending = true;
+			cpwm_interval_irq(cpwm, h, true);
+		} else {
+			pwm->match_pending = false;
+			cpwm_write(cpwm, h, CPWM_MATCH_1_COUNTER, match);
+			cpwm_interval_irq(cpwm, h, pwm->dither_frac);
+		}
+		cpwm_flush(cpwm, h);
+		pwm->duty_updates++;
+		return;
+	}
+
+	/* Make sure counter is stopped */
+	cpwm_write(cpwm, h, CPWM_COUNTER_CTRL,
+		   counter_ctrl | CPWM_COUNTER_CTRL_COUNTING_DISABLE);
+
+	cpwm_write(cpwm, h, CPWM_CLK_CTRL, x);
+
+	/* Set interval and counter control value */
+	cpwm_write(cpwm, h, CPWM_INTERVAL_COUNTER, interval);
+	cpwm_write(cpwm, h, CPWM_MATCH_1_COUNTER, match);
+	pwm->match_pending = false;
+	cpwm_interval_irq(cpwm, h, pwm->dither_frac);
+
+	/* Restore counter */
+	cpwm_write(cpwm, h, CPWM_COUNTER_CTRL, y | CPWM_COUNTER_CTRL_RESET);
+	cpwm_flush(cpwm, h);
+}
+
+/* Distance between a counter value in ticks and the exact tick count
+ * ticks + rem / NSEC_PER_SEC, in ticks / NSEC_PER_SEC. Divided by the clock
+ * rate, that is ns. */
+static u64 cpwm_error(u64 value, u64 ticks, u32 rem)
+{
+	if (value > ticks)
+		return (value - ticks) * CPWM_NSEC_PER_SEC - rem;
+
+	return (ticks - value) * CPWM_NSEC_PER_SEC + rem;
+}
+
+/* Periods up to the counter range at the largest prescaler, 2^32 counter
+ * clock ticks for a 16 bit counter, are supported. Both period and duty cycle
+ * are rounded to counter values as the counter's rounding policy says. */
+static int cpwm_memo_fill(struct cadence_pwm_memo *memo,
+			  const struct cadence_pwm_timebase *tb,
+			  enum cpwm_rounding rounding, u64 duty_ns,
+			  u64 period_ns)
+{
+	u64 counter_max = BIT_ULL(tb->counter_bits) - 1;
+	u64 period_clocks, duty_clocks, interval, match;
+	u32 period_rem, duty_rem;
+	int prescaler;
+
+	/* Also catches a counter clock rate of 0 */
+	if (period_ns >= tb->period_limit_ns[CPWM_MAX_PRESCALER])
+		return -ERANGE;
+
+	/* Calculate period, prescaler, interval and match values */
+	prescaler = cpwm_prescaler(tb, period_ns);
+	period_clocks = cpwm_ns_to_ticks(tb, period_ns, &period_rem);
+	duty_clocks = cpwm_ns_to_ticks(tb, duty_ns, &duty_rem);
+
+	interval = cpwm_round(period_clocks, period_rem, prescaler, rounding);
+	if (interval > counter_max) {
+		/* Rounded up past the counter */
+		if (prescaler < CPWM_MAX_PRESCALER)
+			prescaler++;
+		interval = min(cpwm_round(period_clocks, period_rem, prescaler,
+					  rounding),
+			       counter_max);
+	}
+	match = min(cpwm_round(duty_clocks, duty_rem, prescaler, rounding),
+		    interval);
+
+	memo->period_ns = period_ns;
+	memo->duty_ns = duty_ns;
+	memo->period_ticks = period_clocks;
+	memo->duty_ticks = duty_clocks;
+	/* Both values are within 2^prescaler ticks of the request */
+	memo->error = cpwm_error(interval << prescaler, period_clocks,
+				 period_rem) +
+		      cpwm_error(match << prescaler, duty_clocks, duty_rem);
+	memo->interval = interval;
+	memo->match = match;
+	memo->prescaler = prescaler;
+
+	memo->match_floor = min(duty_clocks >> prescaler, interval);
+	memo->duty_frac = 0;
+	memo->duty_rem = duty_rem;
+	return 0;
+}
+
+/* Below the match value, in 1/2^16 of it, for dithering. Divides, so it is
+ * left out of cpwm_memo_fill(). */
+static void cpwm_memo_fill_frac(struct cadence_pwm_memo *memo)
+{
+	u64 low = memo->duty_ticks & (BIT_ULL(memo->prescaler) - 1);
+
+	if (memo->match_floor < memo->interval)
+		memo->duty_frac =
+			div64_u64((low * CPWM_NSEC_PER_SEC + memo->duty_rem)
+					  << 16,
+				  BIT_ULL(memo->prescaler) * CPWM_NSEC_PER_SEC);
+}
+
+static const struct cadence_pwm_timebase *
+cpwm_timebase(struct cadence_pwm_chip *cpwm, int h, bool external)
+{
+	return external ? &cpwm->pwms[h].tb : &cpwm->system_tb;
+}
+
+/* Returns the MATCH_1 value to program for memo. With dithering enabled and a
+ * fractional duty cycle, the interval interrupt, which the caller turns on,
+ * then alternates MATCH_1 between the two closest values. Called with the
+ * lock held. */
+static u32 cpwm_dither_start(struct cadence_pwm_chip *cpwm, int h,
+			     const struct cadence_pwm_memo *memo)
+{
+	struct cadence_pwm_pwm *pwm = &cpwm->pwms[h];
+	bool dither = pwm->dither && memo->duty_frac;
+
+	pwm->dither_match = memo->match_floor;
+	pwm->dither_frac = dither ? memo->duty_frac : 0;
+
+	return dither ? memo->match_floor : memo->match;
+}
+
+/* Whether counter h, its MATCH_1 holding match, already produces the duty
+ * cycle of memo, counting a match waiting for the interval interrupt and
+ * dithering. Called with the lock held. */
+static bool cpwm_match_current(struct cadence_pwm_chip *cpwm, int h,
+			       const struct cadence_pwm_memo *memo, u32 match)
+{
+	struct cadence_pwm_pwm *pwm = &cpwm->pwms[h];
+	u32 dither_frac = pwm->dither ? memo->duty_frac : 0;
+
+	if (dither_frac != pwm->dither_frac)
+		return false;
+	if (dither_frac)
+		return memo->match_floor == pwm->dither_match;
+	return memo->match == (pwm->match_pending ? pwm->pending_match : match);
+}
+
+/* a * b < c * d, without overflowing the 96 bit products */
+static bool cpwm_mul_less(u64 a, u32 b, u64 c, u32 d)
+{
+	u64 high_ab = mul_u64_u32_shr(a, b, 32);
+	u64 high_cd = mul_u64_u32_shr(c, d, 32);
+
+	if (high_ab != high_cd)
+		return high_ab < high_cd;
+
+	return (u32)a * b < (u32)c * d;
+}
+
+/* A counter with a dedicated clock can also count the system clock. Of the
+ * two, the one whose period and duty cycle are closest to the request in ns
+ * is used, the dedicated clock on a tie. */
+static int cpwm_memo_fill_best(struct cadence_pwm_chip *cpwm, int h,
+			       struct cadence_pwm_memo *memo, u64 duty_ns,
+			       u64 period_ns)
+{
+	struct cadence_pwm_pwm *pwm = &cpwm->pwms[h];
+	enum cpwm_rounding rounding = READ_ONCE(pwm->rounding);
+	struct cadence_pwm_memo alt;
+	int ret;
+
+	/* Without a dedicated clock, clk is system_clk, whose notifiers might
+	 * not all have run yet */
+	ret = cpwm_memo_fill(memo, cpwm_timebase(cpwm, h, pwm->useExternalClk),
+			     rounding, duty_ns, period_ns);
+	memo->external = pwm->useExternalClk;
+
+	if (pwm->useExternalClk &&
+	    !cpwm_memo_fill(&alt, &cpwm->system_tb, rounding, duty_ns,
+			    period_ns)) {
+		alt.external = false;
+		/* error / rate compared without dividing */
+		if (ret || cpwm_mul_less(alt.error, pwm->tb.rate, memo->error,
+					 cpwm->system_tb.rate)) {
+			*memo = alt;
+			ret = 0;
+		}
+	}
+
+	if (!ret && READ_ONCE(pwm->dither))
+		cpwm_memo_fill_frac(memo);
+	return ret;
+}
+
+/* Distance between the period programmed for memo and period_ns, in ns */
+static u64 cpwm_period_error_ns(const struct cadence_pwm_timebase *tb,
+				const struct cadence_pwm_memo *memo,
+				u64 period_ns)
+{
+	u64 achieved = cpwm_ticks_to_ns(tb, (u64)memo->interval
+						    << memo->prescaler);
+
+	return achieved > period_ns ? achieved - period_ns :
+				      period_ns - achieved;
+}
+
+/* Candidates are the rates that would give the period with a full interval
+ * at each prescaler, as far as the clock can get to them, and the current
+ * rate. The closest period wins, the current rate on a tie. */
+static unsigned long cpwm_exact_rate_search(struct cadence_pwm_chip *cpwm,
+					    int h, u64 period_ns,
+					    enum cpwm_rounding rounding)
+{
+	struct cadence_pwm_pwm *pwm = &cpwm->pwms[h];
+	unsigned long best_rate = pwm->tb.rate;
+	u64 best_error = U64_MAX, error;
+	u64 counter_max = BIT_ULL(pwm->tb.counter_bits) - 1;
+	struct cadence_pwm_timebase tb;
+	struct cadence_pwm_memo memo;
+	long rate;
+	int p;
+
+	if (!cpwm_memo_fill(&memo, &pwm->tb, rounding, 0, period_ns))
+		best_error = cpwm_period_error_ns(&pwm->tb, &memo, period_ns);
+
+	tb.counter_bits = pwm->tb.counter_bits;
+	/* Stops before rate * NSEC_PER_SEC overflows; a 32 bit counter is
+	 * only ever tried without prescaler */
+	for (p = 0; p <= CPWM_MAX_PRESCALER && best_error &&
+		    tb.counter_bits + p <= 32;
+	     p++) {
+		rate = clk_round_rate(pwm->clk,
+				      div64_u64((counter_max * CPWM_NSEC_PER_SEC)
+							<< p,
+						period_ns));
+		if (rate <= 0 || rate > U32_MAX)
+			continue;
+
+		cpwm_timebase_set(&tb, rate);
+		if (cpwm_memo_fill(&memo, &tb, rounding, 0, period_ns))
+			continue;
+
+		error = cpwm_period_error_ns(&tb, &memo, period_ns);
+		if (error < best_error) {
+			best_error = error;
+			best_rate = rate;
+		}
+	}
+
+	return best_rate;
+}
+
+/* Sets the dedicated clock to the rate best for period_ns. Searches are
+ * memoized, so a period seen before costs at most a clk_set_rate(). The
+ * clock must not be shared with anything else. */
+static void cpwm_exact_rate(struct cadence_pwm_chip *cpwm, int h,
+			    u64 period_ns)
+{
+	struct cadence_pwm_pwm *pwm = &cpwm->pwms[h];
+	enum cpwm_rounding rounding = READ_ONCE(pwm->rounding);
+	struct cadence_pwm_rate_memo *rm;
+	int ret;
+
+	if (!period_ns)
+		return;
+
+	rm = &pwm->rate_memo[hash_64(period_ns, CPWM_MEMO_BITS)];
+	if (!rm->rate || rm->period_ns != period_ns ||
+	    rm->rounding != rounding) {
+		rm->rate = cpwm_exact_rate_search(cpwm, h, period_ns,
+						  rounding);
+		rm->period_ns = period_ns;
+		rm->rounding = rounding;
+	}
+
+	if (rm->rate == pwm->tb.rate)
+		return;
+
+	/* The clock notifier updates the timebase and drops the memo. Config
+	 * reprograms the counter right after, so the notifier leaves it be. */
+	WRITE_ONCE(pwm->own_rate_change, true);
+	ret = clk_set_rate(pwm->clk, rm->rate);
+	WRITE_ONCE(pwm->own_rate_change, false);
+	if (ret)
+		dev_warn_ratelimited(cpwm->chip.dev,
+				     "cannot set counter %d clock to %lu Hz (error %d)",
+				     h, rm->rate, ret);
+}
+
+/* The duty cycle is clamped to the period. The register values are taken from
+ * the memo when the same request was computed recently. */
+static int cadence_pwm_config(struct pwm_chip *chip, struct pwm_device *pwm,
+			      u64 duty_ns, u64 period_ns)
+{
+	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
+	int h = pwm->hwpwm;
+	struct cadence_pwm_pwm *p = &cpwm->pwms[h];
+	struct cadence_pwm_memo *memo;
+	unsigned long flags;
+	u64 mmio_ops;
+	cycles_t start = get_cycles();
+	int ret = 0;
+	u32 gen;
+
+	if (duty_ns > period_ns)
+		duty_ns = period_ns;
+
+	/* Sleeps, so before taking the lock */
+	if (READ_ONCE(p->exact_period))
+		cpwm_exact_rate(cpwm, h, period_ns);
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	mmio_ops = p->mmio_ops;
+	gen = p->memo_gen;
+
+	memo = &p->memo[hash_64(period_ns, CPWM_MEMO_BITS) ^
+			hash_64(duty_ns, CPWM_MEMO_BITS)];
+	if (memo->gen == gen && memo->period_ns == period_ns &&
+	    memo->duty_ns == duty_ns) {
+		p->memo_hits++;
+	} else {
+		p->memo_misses++;
+		memo->gen = 0;
+		ret = cpwm_memo_fill_best(cpwm, h, memo, duty_ns, period_ns);
+		if (ret)
+			goto unlock;
+		memo->gen = gen;
+	}
+
+	cpwm_program_counter(cpwm, h, memo->external, memo->prescaler,
+			     memo->interval, cpwm_dither_start(cpwm, h, memo));
+	p->period_ns = period_ns;
+	p->duty_ns = duty_ns;
+
+	trace_cpwm_config(cpwm, h, duty_ns, period_ns, memo->prescaler,
+			  memo->duty_ticks, memo->period_ticks, memo->error,
+			  cpwm_timebase(cpwm, h, memo->external)->rate);
+	cpwm_hist_add(cpwm, h, CPWM_OP_CONFIG, start, mmio_ops);
+
+unlock:
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	return ret;
+}
+
+/* Memo entries computed before this are never used. Generation 0 marks
+ * entries never filled. */
+static void cpwm_memo_invalidate(struct cadence_pwm_pwm *pwm)
+{
+	u32 gen = pwm->memo_gen + 1;
+
+	WRITE_ONCE(pwm->memo_gen, gen ? gen : 1);
+}
+
+static void cadence_pwm_disable(struct pwm_chip *chip, struct pwm_device *pwm)
+{
+	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
+	int h = pwm->hwpwm;
+	cycles_t start = get_cycles();
+	unsigned long flags;
+	bool clk_enabled;
+	u64 mmio_ops;
+	uint32_t x;
+
+	trace_cpwm_disable(cpwm, h);
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	mmio_ops = cpwm->pwms[h].mmio_ops;
+
+	x = cpwm_read(cpwm, h, CPWM_COUNTER_CTRL);
+	x |= CPWM_COUNTER_CTRL_COUNTING_DISABLE |
+	     CPWM_COUNTER_CTRL_WAVE_DISABLE;
+	cpwm_write(cpwm, h, CPWM_COUNTER_CTRL, x);
+	cpwm->pwms[h].dither_frac = 0;
+	cpwm->pwms[h].match_pending = false;
+	cpwm_write(cpwm, h, CPWM_INTERRUPT_ENABLE, 0);
+	cpwm_flush(cpwm, h);
+
+	clk_enabled = cpwm->pwms[h].clk_enabled;
+	cpwm->pwms[h].clk_enabled = false;
+	cpwm_hist_add(cpwm, h, CPWM_OP_DISABLE, start, mmio_ops);
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+
+	if (clk_enabled)
+		clk_disable_unprepare(cpwm->pwms[h].clk);
+}
+
+static int cadence_pwm_enable(struct pwm_chip *chip, struct pwm_device *pwm)
+{
+	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
+	int h = pwm->hwpwm;
+	cycles_t start = get_cycles();
+	unsigned long flags;
+	u64 mmio_ops;
+	uint32_t x;
+	int ret;
+
+	trace_cpwm_enable(cpwm, h);
+
+	ret = clk_prepare_enable(cpwm->pwms[h].clk);
+	if (ret) {
+		dev_err(chip->dev, "Can't enable counter clock.\n");
+		return ret;
+	}
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	mmio_ops = cpwm->pwms[h].mmio_ops;
+	cpwm->pwms[h].clk_enabled = true;
+
+	x = cpwm_read(cpwm, h, CPWM_COUNTER_CTRL);
+	x &= ~(CPWM_COUNTER_CTRL_COUNTING_DISABLE |
+	       CPWM_COUNTER_CTRL_WAVE_DISABLE);
+	x |= CPWM_COUNTER_CTRL_RESET;
+	cpwm_write(cpwm, h, CPWM_COUNTER_CTRL, x);
+	cpwm_flush(cpwm, h);
+
+	cpwm_hist_add(cpwm, h, CPWM_OP_ENABLE, start, mmio_ops);
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	return 0;
+}
+
+static int cadence_set_polarity(struct pwm_chip *chip, struct pwm_device *pwm,
+				enum pwm_polarity polarity)
+{
+	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
+	int h = pwm->hwpwm;
+	cpwm->pwms[h].polarity = polarity;
+	return 0;
+}
+
+/* Replaces the legacy callbacks, which only get an int period from the PWM
+ * core, so periods beyond 2^31 ns reach the hardware. The counter clock is
+ * held while the output is enabled. The output may also have been left
+ * enabled by the boot loader, without the clock being held. */
+static int cadence_pwm_apply(struct pwm_chip *chip, struct pwm_device *pwm,
+			     const struct pwm_state *state)
+{
+	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
+	int ret;
+
+	if (!state->enabled) {
+		cadence_pwm_disable(chip, pwm);
+		return 0;
+	}
+
+	cadence_set_polarity(chip, pwm, state->polarity);
+
+	ret = cadence_pwm_config(chip, pwm, state->duty_cycle, state->period);
+	if (ret)
+		return ret;
+
+	if (!cpwm->pwms[pwm->hwpwm].clk_enabled)
+		return cadence_pwm_enable(chip, pwm);
+
+	return 0;
+}
+
+/* Reports what the counter is programmed with, which differs from the last
+ * applied state by the rounding to counter values */
+static void cadence_pwm_get_state(struct pwm_chip *chip,
+				  struct pwm_device *pwm,
+				  struct pwm_state *state)
+{
+	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
+	int h = pwm->hwpwm;
+	const struct cadence_pwm_timebase *tb;
+	uint32_t clk_ctrl, counter_ctrl;
+	unsigned long flags;
+	int prescaler = 0;
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	clk_ctrl = cpwm_read(cpwm, h, CPWM_CLK_CTRL);
+	counter_ctrl = cpwm_read(cpwm, h, CPWM_COUNTER_CTRL);
+
+	tb = cpwm_timebase(cpwm, h, cpwm->pwms[h].useExternalClk &&
+				    (clk_ctrl & CPWM_CLK_SRC_EXTERNAL));
+
+	if (clk_ctrl & CPWM_CLK_PRESCALE_ENABLE)
+		prescaler = ((clk_ctrl & CPWM_CLK_PRESCALE_MASK) >>
+			     CPWM_CLK_PRESCALE_SHIFT) + 1;
+
+	state->period = cpwm_ticks_to_ns(
+		tb, (u64)cpwm_read(cpwm, h, CPWM_INTERVAL_COUNTER) << prescaler);
+	state->duty_cycle = cpwm_ticks_to_ns(
+		tb, (u64)cpwm_read(cpwm, h, CPWM_MATCH_1_COUNTER) << prescaler);
+	state->polarity = counter_ctrl & CPWM_COUNTER_CTRL_WAVE_POL ?
+				  PWM_POLARITY_NORMAL :
+				  PWM_POLARITY_INVERSED;
+	state->enabled = !(counter_ctrl & (CPWM_COUNTER_CTRL_COUNTING_DISABLE |
+					   CPWM_COUNTER_CTRL_WAVE_DISABLE));
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+}
+
+/* Per counter sysfs attributes, in a pwm<n> directory of the device */
+struct cadence_pwm_attribute {
+	struct device_attribute attr;
+	int pwm;
+};
+
+#define to_cadence_pwm_attribute(a)                                         \
+	container_of(a, struct cadence_pwm_attribute, attr)
+
+static ssize_t rounding_show(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	enum cpwm_rounding rounding = READ_ONCE(cpwm->pwms[h].rounding);
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < CPWM_NUM_ROUNDINGS; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 i == rounding ? "[%s] " : "%s ",
+				 cpwm_rounding_names[i]);
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+/* Takes effect on the next configuration of the counter */
+static ssize_t rounding_store(struct device *dev, struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	int rounding;
+
+	rounding = sysfs_match_string(cpwm_rounding_names, buf);
+	if (rounding < 0)
+		return rounding;
+
+	WRITE_ONCE(cpwm->pwms[h].rounding, rounding);
+	cpwm_memo_invalidate(&cpwm->pwms[h]);
+	return count;
+}
+
+static ssize_t exact_period_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+
+	return sprintf(buf, "%d\n", READ_ONCE(cpwm->pwms[h].exact_period));
+}
+
+/* Only counters with a dedicated clock can have its rate changed */
+static ssize_t exact_period_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	bool exact;
+	int ret;
+
+	ret = kstrtobool(buf, &exact);
+	if (ret)
+		return ret;
+
+	if (exact && !cpwm->pwms[h].useExternalClk)
+		return -EOPNOTSUPP;
+
+	WRITE_ONCE(cpwm->pwms[h].exact_period, exact);
+	return count;
+}
+
+static ssize_t dither_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+
+	return sprintf(buf, "%d\n", READ_ONCE(cpwm->pwms[h].dither));
+}
+
+/* Needs the counter interrupt. Takes effect on the next configuration. */
+static ssize_t dither_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	bool dither;
+	int ret;
+
+	ret = kstrtobool(buf, &dither);
+	if (ret)
+		return ret;
+
+	if (dither && !cpwm->pwms[h].irq)
+		return -EOPNOTSUPP;
+
+	WRITE_ONCE(cpwm->pwms[h].dither, dither);
+	/* Memo entries only have a fraction when filled for dithering */
+	cpwm_memo_invalidate(&cpwm->pwms[h]);
+	return count;
+}
+
+/* Of the programmed duty cycle, averaged over 2^16 periods when dithering */
+static ssize_t resolution_bits_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	unsigned long flags;
+	u64 steps;
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	steps = cpwm_read(cpwm, h, CPWM_INTERVAL_COUNTER) + 1ULL;
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	return sprintf(buf, "%d\n",
+		       ilog2(steps) + (READ_ONCE(cpwm->pwms[h].dither) ? 16 : 0));
+}
+
+static ssize_t period_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	struct pwm_state state;
+
+	cadence_pwm_get_state(&cpwm->chip, &cpwm->chip.pwms[h], &state);
+	return sprintf(buf, "%llu\n", state.period);
+}
+
+static ssize_t duty_cycle_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	struct pwm_state state;
+
+	cadence_pwm_get_state(&cpwm->chip, &cpwm->chip.pwms[h], &state);
+	return sprintf(buf, "%llu\n", state.duty_cycle);
+}
+
+/* Periods config can program, with either clock when the counter has a
+ * dedicated one. Both are 0 without a running clock. Called with the lock
+ * held, as are all readers of the timebases. */
+static void cpwm_period_range(struct cadence_pwm_chip *cpwm, int h,
+			      u64 *min_ns, u64 *max_ns)
+{
+	const struct cadence_pwm_timebase *tbs[] = { &cpwm->pwms[h].tb,
+						     &cpwm->system_tb };
+	u64 limit = 0;
+	int i;
+
+	*min_ns = U64_MAX;
+	for (i = 0; i < (cpwm->pwms[h].useExternalClk ? 2 : 1); i++) {
+		if (!tbs[i]->rate)
+			continue;
+		*min_ns = min(*min_ns, cpwm_ticks_to_ns(tbs[i], 1));
+		limit = max(limit, tbs[i]->period_limit_ns[CPWM_MAX_PRESCALER]);
+	}
+
+	if (!limit)
+		*min_ns = 0;
+	*max_ns = limit ? limit - 1 : 0;
+}
+
+static ssize_t period_min_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	unsigned long flags;
+	u64 min_ns, max_ns;
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	cpwm_period_range(cpwm, h, &min_ns, &max_ns);
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	return sprintf(buf, "%llu\n", min_ns);
+}
+
+static ssize_t period_max_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	unsigned long flags;
+	u64 min_ns, max_ns;
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	cpwm_period_range(cpwm, h, &min_ns, &max_ns);
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	return sprintf(buf, "%llu\n", max_ns);
+}
+
+static ssize_t tick_ps_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int h = to_cadence_pwm_attribute(attr)->pwm;
+	unsigned long flags;
+	ssize_t len = 0;
+	int p;
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	for (p = 0; p <= CPWM_MAX_PRESCALER; p++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%llu ",
+				 cpwm_tick_ps(&cpwm->pwms[h].tb, p));
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+static ssize_t counter_bits_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", cpwm->counter_bits);
+}
 
-#define CPWM_NUM_PWM 3
+#define CPWM_ATTR_RO(_name, _pwm)                                           \
+	static struct cadence_pwm_attribute cpwm_attr_##_name##_pwm = {      \
+		.attr = __ATTR_RO(_name),                                    \
+		.pwm = _pwm,                                                 \
+	}
+#define CPWM_ATTR_RW(_name, _pwm)                                           \
+	static struct cadence_pwm_attribute cpwm_attr_##_name##_pwm = {      \
+		.attr = __ATTR_RW(_name),                                    \
+		.pwm = _pwm,                                                 \
+	}
 
-/* For PWM operation, we want "interval mode" where "Interval mode: The counter
-increments or decrements continuously between 0 and the value of the Interval
-register, with the direction of counting determined by the DEC bit of the
-Counter Control register. An interval interrupt is generated when the counter
-passes through zero. The corresponding match interrupt is generated when the
-counter value equals one of the Match registers." [UG585] */
+/* period and duty_cycle are the programmed values, see get_state. The
+ * others tell what the counter can do at the current clock rates:
+ * period_min and period_max with either clock it can count, tick_ps at each
+ * prescaler of its own clock. */
+#define CPWM_ATTR_GROUP(_pwm)                                               \
+	CPWM_ATTR_RW(rounding, _pwm);                                        \
+	CPWM_ATTR_RW(exact_period, _pwm);                                    \
+	CPWM_ATTR_RW(dither, _pwm);                                          \
+	CPWM_ATTR_RO(resolution_bits, _pwm);                                 \
+	CPWM_ATTR_RO(period, _pwm);                                          \
+	CPWM_ATTR_RO(duty_cycle, _pwm);                                      \
+	CPWM_ATTR_RO(period_min, _pwm);                                      \
+	CPWM_ATTR_RO(period_max, _pwm);                                      \
+	CPWM_ATTR_RO(tick_ps, _pwm);                                         \
+	CPWM_ATTR_RO(counter_bits, _pwm);                                    \
+	static struct attribute *cpwm_attrs##_pwm[] = {                      \
+		&cpwm_attr_rounding##_pwm.attr.attr,                         \
+		&cpwm_attr_exact_period##_pwm.attr.attr,                     \
+		&cpwm_attr_dither##_pwm.attr.attr,                           \
+		&cpwm_attr_resolution_bits##_pwm.attr.attr,                  \
+		&cpwm_attr_period##_pwm.attr.attr,                           \
+		&cpwm_attr_duty_cycle##_pwm.attr.attr,                       \
+		&cpwm_attr_period_min##_pwm.attr.attr,                       \
+		&cpwm_attr_period_max##_pwm.attr.attr,                       \
+		&cpwm_attr_tick_ps##_pwm.attr.attr,                          \
+		&cpwm_attr_counter_bits##_pwm.attr.attr,                     \
+		NULL,                                                        \
+	};                                                                   \
+	static const struct attribute_group cpwm_group##_pwm = {             \
+		.name = "pwm" #_pwm,                                         \
+		.attrs = cpwm_attrs##_pwm,                                   \
+	}
 
-struct cadence_pwm_pwm {
-	struct clk *clk; // associated clock
-	bool useExternalClk; // internal/external clock switch
-	enum pwm_polarity polarity;
-};
+CPWM_ATTR_GROUP(0);
+CPWM_ATTR_GROUP(1);
+CPWM_ATTR_GROUP(2);
 
-struct cadence_pwm_chip {
-	struct pwm_chip chip;
-	uint32_t hwaddr;
-	char __iomem *base;
-	struct clk *system_clk;
-	struct cadence_pwm_pwm pwms[CPWM_NUM_PWM];
+static const struct attribute_group *cadence_pwm_groups[] = {
+	&cpwm_group0,
+	&cpwm_group1,
+	&cpwm_group2,
+	NULL,
 };
 
-static inline struct cadence_pwm_chip *cadence_pwm_get(struct pwm_chip *chip)
+static void cpwm_query_range(struct cadence_pwm_chip *cpwm,
+			     struct cpwm_range *range)
 {
-	return container_of(chip, struct cadence_pwm_chip, chip);
+	const struct cadence_pwm_timebase *tb = &cpwm->pwms[range->pwm].tb;
+	unsigned long flags;
+	int p;
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	range->rate = tb->rate;
+	range->counter_bits = cpwm->counter_bits;
+	range->system_rate = cpwm->system_tb.rate;
+	cpwm_period_range(cpwm, range->pwm, &range->period_min_ns,
+			  &range->period_max_ns);
+	for (p = 0; p <= CPWM_MAX_PRESCALER; p++)
+		range->tick_ps[p] = cpwm_tick_ps(tb, p);
+	spin_unlock_irqrestore(&cpwm->lock, flags);
 }
 
-static inline volatile __iomem uint32_t *
-cpwm_register_address(struct cadence_pwm_chip *cpwm, int pwm,
-		      enum cpwm_register reg)
+/* Computes what a config of the period would program, without the memo */
+static int cpwm_query_resolution(struct cadence_pwm_chip *cpwm,
+				 struct cpwm_resolution *res)
 {
-	return (uint32_t *)(4 * (3 * reg + pwm) + (char *)cpwm->base);
+	struct cadence_pwm_memo memo;
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	ret = cpwm_memo_fill_best(cpwm, res->pwm, &memo, 0, res->period_ns);
+	if (!ret)
+		res->step_ps = cpwm_tick_ps(cpwm_timebase(cpwm, res->pwm,
+							  memo.external),
+					    memo.prescaler);
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	if (ret)
+		return ret;
+
+	res->prescaler = memo.prescaler;
+	res->steps = memo.interval;
+	res->bits = ilog2((u64)memo.interval + 1);
+	return 0;
 }
 
-static uint32_t cpwm_read(struct cadence_pwm_chip *cpwm, int pwm,
-			  enum cpwm_register reg)
+/* Same math as config, including the duty cycle clamp. Called with the lock
+ * held. */
+static void cpwm_round_request(struct cadence_pwm_chip *cpwm,
+			       struct cpwm_round *req)
 {
-	uint32_t x;
+	const struct cadence_pwm_timebase *tb;
+	struct cadence_pwm_memo memo;
+
+	req->status = cpwm_memo_fill_best(cpwm, req->pwm, &memo,
+					  min(req->duty_ns, req->period_ns),
+					  req->period_ns);
+	if (req->status)
+		return;
+
+	tb = cpwm_timebase(cpwm, req->pwm, memo.external);
+	req->period_ns = cpwm_ticks_to_ns(tb, (u64)memo.interval
+						      << memo.prescaler);
+	req->duty_ns = cpwm_ticks_to_ns(tb, (u64)memo.match << memo.prescaler);
+	req->prescaler = memo.prescaler;
+	req->interval = memo.interval;
+	req->match = memo.match;
+	req->external = memo.external;
+}
 
-	x = ioread32(cpwm_register_address(cpwm, pwm, reg));
-	dev_dbg(cpwm->chip.dev, "read  %08x from %p:%d register %s", x, cpwm,
-		pwm, cpwm_register_names[reg]);
-	return x;
+#define CPWM_ROUND_CHUNK 16
+
+static int cpwm_round_batch(struct cadence_pwm_chip *cpwm,
+			    const struct cpwm_round_batch *batch)
+{
+	struct cpwm_round __user *ureqs = u64_to_user_ptr(batch->requests);
+	struct cpwm_round reqs[CPWM_ROUND_CHUNK];
+	unsigned long flags;
+	u32 done, n, i;
+
+	for (done = 0; done < batch->count; done += n) {
+		n = min_t(u32, batch->count - done, CPWM_ROUND_CHUNK);
+		if (copy_from_user(reqs, ureqs + done, n * sizeof(reqs[0])))
+			return -EFAULT;
+
+		for (i = 0; i < n; i++)
+			if (reqs[i].pwm >= CPWM_NUM_PWM)
+				return -EINVAL;
+
+		/* A chunk at a time, against consistent timebases */
+		spin_lock_irqsave(&cpwm->lock, flags);
+		for (i = 0; i < n; i++)
+			cpwm_round_request(cpwm, &reqs[i]);
+		spin_unlock_irqrestore(&cpwm->lock, flags);
+
+		if (copy_to_user(ureqs + done, reqs, n * sizeof(reqs[0])))
+			return -EFAULT;
+		cond_resched();
+	}
+
+	return 0;
 }
 
-static void cpwm_write(struct cadence_pwm_chip *cpwm, int pwm,
-		       enum cpwm_register reg, uint32_t value)
+static long cadence_pwm_ioctl(struct file *file, unsigned int cmd,
+			      unsigned long arg)
 {
-	dev_dbg(cpwm->chip.dev, "write %08x  to  %p:%d register %s", value,
-		cpwm, pwm, cpwm_register_names[reg]);
-	iowrite32(value, cpwm_register_address(cpwm, pwm, reg));
+	struct cadence_pwm_chip *cpwm =
+		container_of(file->private_data, struct cadence_pwm_chip,
+			     miscdev);
+	void __user *argp = (void __user *)arg;
+	union {
+		struct cpwm_range range;
+		struct cpwm_resolution res;
+		struct cpwm_round_batch batch;
+	} u;
+	int ret = 0;
+
+	switch (cmd) {
+	case CPWM_IOC_RANGE:
+	case CPWM_IOC_RESOLUTION:
+	case CPWM_IOC_ROUND:
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	if (copy_from_user(&u, argp, _IOC_SIZE(cmd)))
+		return -EFAULT;
+
+	if (cmd == CPWM_IOC_ROUND)
+		return cpwm_round_batch(cpwm, &u.batch);
+
+	/* pwm is the first member of range and res */
+	if (u.range.pwm >= CPWM_NUM_PWM)
+		return -EINVAL;
+
+	if (cmd == CPWM_IOC_RANGE)
+		cpwm_query_range(cpwm, &u.range);
+	else
+		ret = cpwm_query_resolution(cpwm, &u.res);
+	if (ret)
+		return ret;
+
+	if (copy_to_user(argp, &u, _IOC_SIZE(cmd)))
+		return -EFAULT;
+
+	return 0;
 }
 
-/* "If the waveform output mode is enabled, the waveform will change polarity
- * when the count matches the value in the match 0 register." - [ttcps_v2_0]
- */
+static const struct file_operations cadence_pwm_misc_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = cadence_pwm_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = noop_llseek,
+};
 
-static int cadence_pwm_config(struct pwm_chip *chip, struct pwm_device *pwm,
-			      int duty_ns, int period_ns)
+#ifndef CONFIG_PWM_CADENCE_REGMAP
+
+static int cadence_pwm_stats_show(struct seq_file *s, void *data)
 {
-	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
-	int h = pwm->hwpwm;
-	uint32_t counter_ctrl, x;
-	int period_clocks, duty_clocks, prescaler;
-	int ret;
+	struct cadence_pwm_chip *cpwm = s->private;
+	struct cadence_pwm_stats *stats;
+	int i, reg;
 
-	dev_dbg(chip->dev, "configuring %p/%s(%d), %d/%d ns", cpwm, pwm->label,
-		h, duty_ns, period_ns);
+	for (i = 0; i < CPWM_NUM_PWM; i++) {
+		stats = &cpwm->pwms[i].stats;
+		seq_printf(s, "pwm%d: reads issued %llu avoided %llu\n", i,
+			   stats->reads_issued, stats->reads_avoided);
+		for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++)
+			seq_printf(s,
+				   "pwm%d: %-19s writes issued %llu elided %llu\n",
+				   i, cpwm_register_names[reg],
+				   stats->writes_issued[reg],
+				   stats->writes_elided[reg]);
+	}
 
-	ret = clk_prepare_enable(cpwm->pwms[h].clk);
-	if (ret) {
-		dev_err(chip->dev, "Can't enable counter clock.\n");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cadence_pwm_stats);
+
+#define CPWM_BENCH_LOOPS 1000
+
+/* Time the config register sequence with strict and relaxed accessors on a
+ * counter nobody requested, then put its registers back. The interval
+ * alternates so that no write gets elided. relaxed applies to the whole chip,
+ * so each sequence sets it under the lock, which is taken per sequence rather
+ * than for the whole run: interrupts and the other counters wait for one
+ * sequence at most, and both modes pay for the lock alike. A consumer that
+ * requests the counter meanwhile ends the run and keeps its settings. */
+static int cadence_pwm_bench_run(struct cadence_pwm_chip *cpwm, int h)
+{
+	uint32_t saved[CPWM_NUM_REGISTERS];
+	unsigned long flags;
+	bool relaxed;
+	u64 cycles[2];
+	cycles_t start;
+	int mode, i, reg, ret = 0;
+
+	if (h < 0 || h >= CPWM_NUM_PWM)
+		return -EINVAL;
+
+	spin_lock_irqsave(&cpwm->lock, flags);
+	if (cpwm->bench.running ||
+	    test_bit(PWMF_REQUESTED, &cpwm->chip.pwms[h].flags))
+		ret = -EBUSY;
+	else
+		cpwm->bench.running = true;
+	for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++)
+		saved[reg] = cpwm->shadow[reg][h];
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	if (ret)
 		return ret;
+
+	for (mode = 0; mode < 2 && !ret; mode++) {
+		start = get_cycles();
+		for (i = 0; i < CPWM_BENCH_LOOPS && !ret; i++) {
+			spin_lock_irqsave(&cpwm->lock, flags);
+			if (test_bit(PWMF_REQUESTED,
+				     &cpwm->chip.pwms[h].flags)) {
+				ret = -EBUSY;
+			} else {
+				relaxed = cpwm->relaxed;
+				cpwm->relaxed = mode;
+				cpwm_program_counter(
+					cpwm, h, cpwm->pwms[h].useExternalClk,
+					0, 2 + (i & 1), 1);
+				cpwm->relaxed = relaxed;
+			}
+			spin_unlock_irqrestore(&cpwm->lock, flags);
+		}
+		cycles[mode] = get_cycles() - start;
 	}
 
-	if (period_ns < 0)
-		return -EINVAL;
+	spin_lock_irqsave(&cpwm->lock, flags);
+	if (!ret && test_bit(PWMF_REQUESTED, &cpwm->chip.pwms[h].flags))
+		ret = -EBUSY;
+	if (!ret) {
+		for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++)
+			if (!cpwm_register_volatile(reg) &&
+			    reg != CPWM_COUNTER_CTRL)
+				cpwm_write(cpwm, h, reg, saved[reg]);
+		cpwm_write(cpwm, h, CPWM_COUNTER_CTRL,
+			   saved[CPWM_COUNTER_CTRL]);
+		cpwm_flush(cpwm, h);
+
+		cpwm->bench.pwm = h;
+		cpwm->bench.strict_cycles = cycles[0];
+		cpwm->bench.relaxed_cycles = cycles[1];
+	}
+	cpwm->bench.running = false;
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+	return ret;
+}
 
-	/* Make sure counter is stopped */
-	counter_ctrl = cpwm_read(cpwm, h, CPWM_COUNTER_CTRL);
-	cpwm_write(cpwm, h, CPWM_COUNTER_CTRL,
-		   counter_ctrl | CPWM_COUNTER_CTRL_COUNTING_DISABLE);
+static int cadence_pwm_bench_show(struct seq_file *s, void *data)
+{
+	struct cadence_pwm_chip *cpwm = s->private;
+	struct cadence_pwm_bench *bench = &cpwm->bench;
 
-	/* Calculate period, prescaler and set clock control register */
-	period_clocks = div64_u64(
-		((int64_t)period_ns * (int64_t)clk_get_rate(cpwm->pwms[h].clk)),
-		1000000000LL);
+	if (bench->pwm < 0) {
+		seq_puts(s, "write a counter number to run the benchmark\n");
+		return 0;
+	}
 
-	prescaler = ilog2(period_clocks) + 1 - 16;
-	if (prescaler < 0)
-		prescaler = 0;
+	seq_printf(s, "pwm%d: %d config sequences\n", bench->pwm,
+		   CPWM_BENCH_LOOPS);
+	seq_printf(s, "strict:  %llu cycles/call\n",
+		   div_u64(bench->strict_cycles, CPWM_BENCH_LOOPS));
+	seq_printf(s, "relaxed: %llu cycles/call\n",
+		   div_u64(bench->relaxed_cycles, CPWM_BENCH_LOOPS));
+	return 0;
+}
 
-	x = cpwm_read(cpwm, h, CPWM_CLK_CTRL);
+static int cadence_pwm_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cadence_pwm_bench_show, inode->i_private);
+}
 
-	if (!prescaler)
-		x &= ~(CPWM_CLK_PRESCALE_ENABLE | CPWM_CLK_PRESCALE_MASK);
-	else {
-		x &= ~CPWM_CLK_PRESCALE_MASK;
-		x |= CPWM_CLK_PRESCALE_ENABLE |
-		     (((prescaler - 1) << CPWM_CLK_PRESCALE_SHIFT) &
-		      CPWM_CLK_PRESCALE_MASK);
-	};
+static ssize_t cadence_pwm_bench_write(struct file *file,
+				       const char __user *ubuf, size_t len,
+				       loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	unsigned int h;
+	int ret;
 
-	if (cpwm->pwms[h].useExternalClk)
-		x |= CPWM_CLK_SRC_EXTERNAL;
-	else
-		x &= ~CPWM_CLK_SRC_EXTERNAL;
+	ret = kstrtouint_from_user(ubuf, len, 0, &h);
+	if (ret)
+		return ret;
 
-	cpwm_write(cpwm, h, CPWM_CLK_CTRL, x);
+	ret = cadence_pwm_bench_run(s->private, h);
+	return ret ? ret : len;
+}
 
-	/* Calculate interval and set counter control value */
-	duty_clocks = div64_u64(
-		((int64_t)duty_ns * (int64_t)clk_get_rate(cpwm->pwms[h].clk)),
-		1000000000LL);
+static const struct file_operations cadence_pwm_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = cadence_pwm_bench_open,
+	.read = seq_read,
+	.write = cadence_pwm_bench_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-	cpwm_write(cpwm, h, CPWM_INTERVAL_COUNTER,
-		   (period_clocks >> prescaler) & 0xffff);
-	cpwm_write(cpwm, h, CPWM_MATCH_1_COUNTER,
-		   (duty_clocks >> prescaler) & 0xffff);
+struct cadence_pwm_log_snapshot {
+	size_t len;
+	struct cpwm_log_record records[];
+};
 
-	/* Restore counter */
-	counter_ctrl &= ~CPWM_COUNTER_CTRL_DECREMENT_ENABLE;
-	counter_ctrl |= CPWM_COUNTER_CTRL_INTERVAL_ENABLE |
-			CPWM_COUNTER_CTRL_RESET |
-			CPWM_COUNTER_CTRL_MATCH_ENABLE;
+/* Readers get a copy of the ring as it was at open time, oldest first */
+static int cadence_pwm_log_open(struct inode *inode, struct file *file)
+{
+	struct cadence_pwm_chip *cpwm = inode->i_private;
+	struct cadence_pwm_log_snapshot *snap;
+	unsigned int head, n, i;
 
-	if (cpwm->pwms[h].polarity == PWM_POLARITY_NORMAL)
-		counter_ctrl |= CPWM_COUNTER_CTRL_WAVE_POL;
-	else
-		counter_ctrl &= ~CPWM_COUNTER_CTRL_WAVE_POL;
+	head = atomic_read(&cpwm->log.head);
+	n = min(head, cpwm->log.mask + 1);
 
-	cpwm_write(cpwm, h, CPWM_COUNTER_CTRL, counter_ctrl);
+	snap = vmalloc(sizeof(*snap) + n * sizeof(snap->records[0]));
+	if (!snap)
+		return -ENOMEM;
 
-	dev_dbg(chip->dev, "%d/%d clocks, prescaler 2^%d", duty_clocks,
-		period_clocks, prescaler);
+	for (i = 0; i < n; i++)
+		snap->records[i] =
+			cpwm->log.records[(head - n + i) & cpwm->log.mask];
+	snap->len = n * sizeof(snap->records[0]);
 
+	file->private_data = snap;
 	return 0;
 }
 
-static void cadence_pwm_disable(struct pwm_chip *chip, struct pwm_device *pwm)
+static ssize_t cadence_pwm_log_read(struct file *file, char __user *ubuf,
+				    size_t len, loff_t *ppos)
 {
-	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
-	int h = pwm->hwpwm;
-	uint32_t x;
+	struct cadence_pwm_log_snapshot *snap = file->private_data;
 
-	dev_dbg(chip->dev, "Disabling");
+	return simple_read_from_buffer(ubuf, len, ppos, snap->records,
+				       snap->len);
+}
 
-	x = cpwm_read(cpwm, h, CPWM_COUNTER_CTRL);
-	x |= CPWM_COUNTER_CTRL_COUNTING_DISABLE |
-	     CPWM_COUNTER_CTRL_WAVE_DISABLE;
-	cpwm_write(cpwm, h, CPWM_COUNTER_CTRL, x);
+static int cadence_pwm_log_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations cadence_pwm_log_fops = {
+	.owner = THIS_MODULE,
+	.open = cadence_pwm_log_open,
+	.read = cadence_pwm_log_read,
+	.llseek = default_llseek,
+	.release = cadence_pwm_log_release,
+};
 
-	clk_disable_unprepare(cpwm->pwms[h].clk);
+#endif /* CONFIG_PWM_CADENCE_REGMAP */
+
+/* All registers are read back to back with interrupts off, and only formatted
+ * afterwards, so that the counter values of the three counters can be
+ * compared. This bypasses the shadow copy and the access log. Note that
+ * reading INTERRUPT_REGISTER clears it, so it is left out for counters whose
+ * interrupt is enabled. */
+static int cadence_pwm_snapshot_show(struct seq_file *s, void *data)
+{
+	struct cadence_pwm_chip *cpwm = s->private;
+	uint32_t regs[CPWM_NUM_REGISTERS][CPWM_NUM_PWM];
+	bool skipped[CPWM_NUM_PWM];
+	unsigned long flags;
+	cycles_t start, end;
+	int pwm, reg;
+
+	/* Reading it would steal the interval status cadence_pwm_irq() needs.
+	 * The lock keeps interrupts from being enabled meanwhile. */
+	spin_lock_irqsave(&cpwm->lock, flags);
+	start = get_cycles();
+	for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+		skipped[pwm] = readl_relaxed(cpwm_register_address(
+				       cpwm, pwm, CPWM_INTERRUPT_ENABLE)) != 0;
+	for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++)
+		for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+			if (reg != CPWM_INTERRUPT_REGISTER || !skipped[pwm])
+				regs[reg][pwm] = readl_relaxed(
+					cpwm_register_address(cpwm, pwm, reg));
+	end = get_cycles();
+	spin_unlock_irqrestore(&cpwm->lock, flags);
+
+	seq_printf(s, "captured in %llu cycles\n", (u64)(end - start));
+	seq_printf(s, "%-19s %-8s %-8s %-8s\n", "", "pwm0", "pwm1", "pwm2");
+	for (reg = 0; reg < CPWM_NUM_REGISTERS; reg++) {
+		seq_printf(s, "%-19s", cpwm_register_names[reg]);
+		for (pwm = 0; pwm < CPWM_NUM_PWM; pwm++)
+			if (reg == CPWM_INTERRUPT_REGISTER && skipped[pwm])
+				seq_puts(s, " --------");
+			else
+				seq_printf(s, " %08x", regs[reg][pwm]);
+		seq_putc(s, '\n');
+	}
+
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(cadence_pwm_snapshot);
 
-static int cadence_pwm_enable(struct pwm_chip *chip, struct pwm_device *pwm)
+static int cadence_pwm_latency_show(struct seq_file *s, void *data)
 {
-	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
-	int h = pwm->hwpwm;
-	uint32_t x;
-	int ret;
+	struct cadence_pwm_chip *cpwm = s->private;
+	struct cadence_pwm_hist *hist;
+	int i, op, b;
+
+	for (i = 0; i < CPWM_NUM_PWM; i++)
+		for (op = 0; op < CPWM_NUM_OPS; op++) {
+			hist = &cpwm->pwms[i].hist[op];
+			if (!hist->calls)
+				continue;
+
+			seq_printf(s,
+				   "pwm%d %s: %llu calls, %llu mmio ops/call (max %llu)\n",
+				   i, cpwm_op_names[op], hist->calls,
+				   div64_u64(hist->mmio_ops, hist->calls),
+				   hist->mmio_ops_max);
+			for (b = 0; b < CPWM_HIST_BUCKETS; b++)
+				if (hist->buckets[b])
+					seq_printf(s, "  %10llu cycles: %llu\n",
+						   1ULL << b, hist->buckets[b]);
+		}
 
-	dev_dbg(chip->dev, "enabling");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cadence_pwm_latency);
 
-	ret = clk_prepare_enable(cpwm->pwms[h].clk);
-	if (ret) {
-		dev_err(chip->dev, "Can't enable counter clock.\n");
-		return ret;
-	}
+static ssize_t cadence_pwm_latency_reset_write(struct file *file,
+					       const char __user *ubuf,
+					       size_t len, loff_t *ppos)
+{
+	struct cadence_pwm_chip *cpwm = file->private_data;
+	int i;
 
-	x = cpwm_read(cpwm, h, CPWM_COUNTER_CTRL);
-	x &= ~(CPWM_COUNTER_CTRL_COUNTING_DISABLE |
-	       CPWM_COUNTER_CTRL_WAVE_DISABLE);
-	x |= CPWM_COUNTER_CTRL_RESET;
-	cpwm_write(cpwm, h, CPWM_COUNTER_CTRL, x);
+	for (i = 0; i < CPWM_NUM_PWM; i++)
+		memset(cpwm->pwms[i].hist, 0, sizeof(cpwm->pwms[i].hist));
+
+	return len;
+}
+
+static int cadence_pwm_memo_show(struct seq_file *s, void *data)
+{
+	struct cadence_pwm_chip *cpwm = s->private;
+	int i;
+
+	for (i = 0; i < CPWM_NUM_PWM; i++)
+		seq_printf(s,
+			   "pwm%d: memo hits %llu misses %llu, duty-only updates %llu\n",
+			   i, cpwm->pwms[i].memo_hits,
+			   cpwm->pwms[i].memo_misses,
+			   cpwm->pwms[i].duty_updates);
 
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(cadence_pwm_memo);
 
-static int cadence_set_polarity(struct pwm_chip *chip, struct pwm_device *pwm,
-				enum pwm_polarity polarity)
+static int cadence_pwm_retime_show(struct seq_file *s, void *data)
 {
-	struct cadence_pwm_chip *cpwm = cadence_pwm_get(chip);
-	int h = pwm->hwpwm;
-	cpwm->pwms[h].polarity = polarity;
+	struct cadence_pwm_chip *cpwm = s->private;
+	struct cadence_pwm_retime *retime = &cpwm->retime;
+
+	seq_printf(s, "reprogrammed after %llu clock rate changes\n",
+		   retime->count);
+	seq_printf(s, "last: %llu ns after the change, %llu ns after the notice\n",
+		   retime->last_ns, retime->window_ns);
+	seq_printf(s, "max: %llu ns after the change\n", retime->max_ns);
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(cadence_pwm_retime);
+
+static const struct file_operations cadence_pwm_latency_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = cadence_pwm_latency_reset_write,
+};
+
+static void cadence_pwm_debugfs_init(struct cadence_pwm_chip *cpwm)
+{
+	cpwm->debugfs = debugfs_create_dir(dev_name(cpwm->chip.dev),
+					   cadence_pwm_debugfs_root);
+	debugfs_create_file("snapshot", 0400, cpwm->debugfs, cpwm,
+			    &cadence_pwm_snapshot_fops);
+	debugfs_create_file("latency", 0444, cpwm->debugfs, cpwm,
+			    &cadence_pwm_latency_fops);
+	debugfs_create_file("latency_reset", 0200, cpwm->debugfs, cpwm,
+			    &cadence_pwm_latency_reset_fops);
+	debugfs_create_file("memo", 0444, cpwm->debugfs, cpwm,
+			    &cadence_pwm_memo_fops);
+	debugfs_create_file("retime", 0444, cpwm->debugfs, cpwm,
+			    &cadence_pwm_retime_fops);
+#ifndef CONFIG_PWM_CADENCE_REGMAP
+	debugfs_create_file("stats", 0444, cpwm->debugfs, cpwm,
+			    &cadence_pwm_stats_fops);
+	debugfs_create_file("benchmark", 0644, cpwm->debugfs, cpwm,
+			    &cadence_pwm_bench_fops);
+	if (cpwm->log.records)
+		debugfs_create_file("mmio_log", 0400, cpwm->debugfs, cpwm,
+				    &cadence_pwm_log_fops);
+#endif
+}
 
 static const struct pwm_ops cadence_pwm_ops = {
-	.config = cadence_pwm_config,
-	.enable = cadence_pwm_enable,
-	.disable = cadence_pwm_disable,
-	.set_polarity = cadence_set_polarity,
+	.apply = cadence_pwm_apply,
+	.get_state = cadence_pwm_get_state,
 	.owner = THIS_MODULE,
 };
 
+/* Recomputes the register values of the running counters in mask from their
+ * last request at the current clock rates, and writes them all in one batch,
+ * restarting those whose values changed. Called with the lock held, start
+ * being when the rate change was seen. */
+static void cpwm_retime(struct cadence_pwm_chip *cpwm, unsigned long mask,
+			u64 start)
+{
+	uint32_t clk_ctrl[CPWM_NUM_PWM], interval[CPWM_NUM_PWM];
+	uint32_t match[CPWM_NUM_PWM], counter_ctrl[CPWM_NUM_PWM];
+	struct cadence_pwm_retime *retime = &cpwm->retime;
+	struct cadence_pwm_memo memo;
+	struct cadence_pwm_pwm *pwm;
+	bool changed = false;
+	uint32_t x;
+	u64 end;
+	int h;
+
+	/* Also keeps away from the registers until probe has set them up */
+	for (h = 0; h < CPWM_NUM_PWM; h++)
+		if (!cpwm->pwms[h].clk_enabled || !cpwm->pwms[h].period_ns)
+			mask &= ~BIT(h);
+	if (!mask)
+		return;
+
+	for (h = 0; h < CPWM_NUM_PWM; h++) {
+		pwm = &cpwm->pwms[h];
+		clk_ctrl[h] = cpwm_read(cpwm, h, CPWM_CLK_CTRL);
+		interval[h] = cpwm_read(cpwm, h, CPWM_INTERVAL_COUNTER);
+		match[h] = cpwm_read(cpwm, h, CPWM_MATCH_1_COUNTER);
+		counter_ctrl[h] = cpwm_read(cpwm, h, CPWM_COUNTER_CTRL);
+
+		if (!(mask & BIT(h)))
+			continue;
+
+		if (cpwm_memo_fill_best(cpwm, h, &memo, pwm->duty_ns,
+					pwm->period_ns)) {
+			dev_warn_ratelimited(cpwm->chip.dev,
+					     "period of counter %d out of range at the new clock rate",
+					     h);
+			continue;
+		}
+
+		/* Left running where nothing changes, such as on a dedicated
+		 * clock when the system clock changed */
+		x = cpwm_clk_ctrl(clk_ctrl[h], memo.external, memo.prescaler);
+		if (x == clk_ctrl[h] && memo.interval == interval[h] &&
+		    cpwm_match_current(cpwm, h, &memo, match[h]))
+			continue;
+
+		clk_ctrl[h] = x;
+		interval[h] = memo.interval;
+		match[h] = cpwm_dither_start(cpwm, h, &memo);
+		pwm->match_pending = false;
+		cpwm_interval_irq(cpwm, h, pwm->dither_frac);
+		counter_ctrl[h] |= CPWM_COUNTER_CTRL_RESET;
+		changed = true;
+	}
+
+	if (!changed)
+		return;
+
+	cpwm_write_all(cpwm, CPWM_CLK_CTRL, clk_ctrl);
+	cpwm_write_all(cpwm, CPWM_INTERVAL_COUNTER, interval);
+	cpwm_write_all(cpwm, CPWM_MATCH_1_COUNTER, match);
+	cpwm_write_all(cpwm, CPWM_COUNTER_CTRL, counter_ctrl);
+	cpwm_flush_all(cpwm);
+
+	end = local_clock();
+	retime->count++;
+	retime->last_ns = end - start;
+	retime->max_ns = max(retime->max_ns, retime->last_ns);
+	retime->window_ns = retime->pre_ns ? end - retime->pre_ns : 0;
+	retime->pre_ns = 0;
+}
+
+/* Keeps the cached counter clock rate current, so that config never has to
+ * enter the clock framework, and the running waveforms what was requested */
+static int cadence_pwm_clk_notify(struct notifier_block *nb,
+				  unsigned long event, void *data)
+{
+	struct cadence_pwm_pwm *pwm =
+		container_of(nb, struct cadence_pwm_pwm, clk_nb);
+	struct cadence_pwm_chip *cpwm = pwm->cpwm;
+	struct clk_notifier_data *ndata = data;
+	unsigned long flags;
+	bool retime;
+	u64 start;
+
+	/* Without a dedicated clock, the system clock notifier does it */
+	retime = pwm->useExternalClk && !READ_ONCE(pwm->own_rate_change);
+
+	switch (event) {
+	case PRE_RATE_CHANGE:
+		if (retime)
+			cpwm->retime.pre_ns = local_clock();
+		break;
+	case POST_RATE_CHANGE:
+		start = local_clock();
+		spin_lock_irqsave(&cpwm->lock, flags);
+		cpwm_timebase_set(&pwm->tb, ndata->new_rate);
+		cpwm_memo_invalidate(pwm);
+		if (retime)
+			cpwm_retime(cpwm, BIT(pwm - cpwm->pwms), start);
+		spin_unlock_irqrestore(&cpwm->lock, flags);
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+static int cadence_pwm_system_clk_notify(struct notifier_block *nb,
+					 unsigned long event, void *data)
+{
+	struct cadence_pwm_chip *cpwm =
+		container_of(nb, struct cadence_pwm_chip, system_clk_nb);
+	struct clk_notifier_data *ndata = data;
+	unsigned long flags;
+	u64 start;
+	int i;
+
+	switch (event) {
+	case PRE_RATE_CHANGE:
+		cpwm->retime.pre_ns = local_clock();
+		break;
+	case POST_RATE_CHANGE:
+		start = local_clock();
+		spin_lock_irqsave(&cpwm->lock, flags);
+		cpwm_timebase_set(&cpwm->system_tb, ndata->new_rate);
+		for (i = 0; i < CPWM_NUM_PWM; i++)
+			cpwm_memo_invalidate(&cpwm->pwms[i]);
+		cpwm_retime(cpwm, BIT(CPWM_NUM_PWM) - 1, start);
+		spin_unlock_irqrestore(&cpwm->lock, flags);
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+/* Applies a duty cycle update deferred by cpwm_program_counter(), or
+ * dithers: as a first order sigma-delta, the fraction accumulates every
+ * period, and each carry lengthens the duty cycle of the next period by one
+ * counter value */
+static irqreturn_t cadence_pwm_irq(int irq, void *data)
+{
+	struct cadence_pwm_pwm *pwm = data;
+	struct cadence_pwm_chip *cpwm = pwm->cpwm;
+	int h = pwm - cpwm->pwms;
+	uint32_t status;
+
+	spin_lock(&cpwm->lock);
+	status = cpwm_read(cpwm, h, CPWM_INTERRUPT_REGISTER);
+	if ((status & CPWM_INTERRUPT_INTERVAL) && pwm->match_pending) {
+		cpwm_write(cpwm, h, CPWM_MATCH_1_COUNTER, pwm->pending_match);
+		pwm->match_pending = false;
+		if (!pwm->dither_frac)
+			cpwm_write(cpwm, h, CPWM_INTERRUPT_ENABLE, 0);
+	} else if ((status & CPWM_INTERRUPT_INTERVAL) && pwm->dither_frac) {
+		pwm->dither_acc += pwm->dither_frac;
+		cpwm_write(cpwm, h, CPWM_MATCH_1_COUNTER,
+			   pwm->dither_match + (pwm->dither_acc >> 16));
+		pwm->dither_acc &= 0xffff;
+	}
+	spin_unlock(&cpwm->lock);
+
+	return status ? IRQ_HANDLED : IRQ_NONE;
+}
+
+/* The width the TTC was synthesized with, which the device tree does not
+ * always get right: all ones written to the interval register of a stopped
+ * counter read back as the bits it implements. The register is restored, and
+ * bypasses the shadow copy or register cache, which are not loaded yet. */
+static unsigned int cpwm_counter_bits(struct cadence_pwm_chip *cpwm)
+{
+	struct device *dev = cpwm->chip.dev;
+	unsigned int bits = 0;
+	uint32_t x;
+	int h;
+
+	for (h = 0; h < CPWM_NUM_PWM; h++)
+		if (readl(cpwm_register_address(cpwm, h, CPWM_COUNTER_CTRL)) &
+		    CPWM_COUNTER_CTRL_COUNTING_DISABLE)
+			break;
+
+	if (h < CPWM_NUM_PWM) {
+		x = readl(cpwm_register_address(cpwm, h,
+						CPWM_INTERVAL_COUNTER));
+		writel(~0U, cpwm_register_address(cpwm, h,
+						  CPWM_INTERVAL_COUNTER));
+		bits = fls(readl(cpwm_register_address(cpwm, h,
+							CPWM_INTERVAL_COUNTER)));
+		writel(x, cpwm_register_address(cpwm, h,
+						CPWM_INTERVAL_COUNTER));
+	}
+
+	if (bits < 16) {
+		dev_warn(dev, "cannot detect counter width, assuming %u bits",
+			 cpwm->variant->counter_bits);
+		return cpwm->variant->counter_bits;
+	}
+
+	if (bits != cpwm->variant->counter_bits)
+		dev_info(dev, "%u bit counters rather than %u", bits,
+			 cpwm->variant->counter_bits);
+	return bits;
+}
+
 static int cadence_pwm_probe(struct platform_device *pdev)
 {
 	struct cadence_pwm_chip *cpwm;
 	struct resource *r_mem;
 	int ret;
 	char clockname[8];
-	int i;
+	const char *rounding;
+	int i, h;
 	struct cadence_pwm_pwm *pwm;
+	static const uint32_t irq_disabled[CPWM_NUM_PWM];
 
 	cpwm = devm_kzalloc(&pdev->dev, sizeof(*cpwm), GFP_KERNEL);
 	if (!cpwm)
@@ -286,6 +2332,11 @@ static int cadence_pwm_probe(struct platform_device *pdev)
 	if (IS_ERR(cpwm->base))
 		return PTR_ERR(cpwm->base);
 
+	cpwm->chip.dev = &pdev->dev;
+	cpwm->variant = of_device_get_match_data(&pdev->dev);
+	if (!cpwm->variant)
+		cpwm->variant = &cadence_pwm_zynq;
+
 	//Try to get system clock
 	cpwm->system_clk = devm_clk_get(&pdev->dev, "system_clk");
 	if (IS_ERR(cpwm->system_clk))
@@ -303,8 +2354,20 @@ static int cadence_pwm_probe(struct platform_device *pdev)
 		return ret;
 	}
 
+	spin_lock_init(&cpwm->lock);
+	cpwm->counter_bits = cpwm_counter_bits(cpwm);
+	cpwm->system_tb.counter_bits = cpwm->counter_bits;
+	cpwm_timebase_set(&cpwm->system_tb, clk_get_rate(cpwm->system_clk));
+	cpwm->system_clk_nb.notifier_call = cadence_pwm_system_clk_notify;
+	ret = clk_notifier_register(cpwm->system_clk, &cpwm->system_clk_nb);
+	if (ret) {
+		dev_err(&pdev->dev, "Can't watch device clock rate");
+		goto disable_system_clk;
+	}
+
 	for (i = 0; i < CPWM_NUM_PWM; i++) {
 		pwm = cpwm->pwms + i;
+		pwm->cpwm = cpwm;
 		snprintf(clockname, sizeof(clockname), "clock%d", i);
 
 		//Try to get a dedicated clock
@@ -317,7 +2380,7 @@ static int cadence_pwm_probe(struct platform_device *pdev)
 			dev_err(&pdev->dev,
 				"Missing clock source for counter %d", i);
 			ret = -ENODEV;
-			goto disable_system_clk;
+			goto unregister_clk_notifiers;
 		}
 
 		if (clk_is_match(pwm->clk, cpwm->system_clk))
@@ -326,9 +2389,74 @@ static int cadence_pwm_probe(struct platform_device *pdev)
 			pwm->useExternalClk = true;
 
 		pwm->polarity = PWM_POLARITY_NORMAL;
+		pwm->memo_gen = 1;
+		pwm->exact_period = pwm->useExternalClk &&
+				    of_property_read_bool(pdev->dev.of_node,
+							  "cdns,exact-period");
+
+		pwm->rounding = CPWM_ROUND_FLOOR;
+		if (!of_property_read_string_index(pdev->dev.of_node,
+						   "cdns,rounding", i,
+						   &rounding)) {
+			ret = match_string(cpwm_rounding_names,
+					   CPWM_NUM_ROUNDINGS, rounding);
+			if (ret >= 0)
+				pwm->rounding = ret;
+			else
+				dev_warn(&pdev->dev,
+					 "Unknown rounding %s for counter %d",
+					 rounding, i);
+		}
+
+		pwm->tb.counter_bits = cpwm->counter_bits;
+		cpwm_timebase_set(&pwm->tb, clk_get_rate(pwm->clk));
+		pwm->clk_nb.notifier_call = cadence_pwm_clk_notify;
+		ret = clk_notifier_register(pwm->clk, &pwm->clk_nb);
+		if (ret) {
+			dev_err(&pdev->dev,
+				"Can't watch clock rate of counter %d", i);
+			goto unregister_clk_notifiers;
+		}
+	}
+
+	cpwm->relaxed = relaxed_mmio;
+	/* The regmap register callbacks look up the layout through the device */
+	platform_set_drvdata(pdev, cpwm);
+#ifndef CONFIG_PWM_CADENCE_REGMAP
+	cpwm->bench.pwm = -1;
+	cpwm_log_init(cpwm);
+#endif
+	ret = cpwm_regs_init(cpwm);
+	if (ret) {
+		dev_err(&pdev->dev, "cannot set up register access (error %d)",
+			ret);
+		goto unregister_clk_notifiers;
+	}
+
+	/* Counter interrupts are only enabled for dithering */
+	cpwm_write_all(cpwm, CPWM_INTERRUPT_ENABLE, irq_disabled);
+	cpwm_flush_all(cpwm);
+
+	for (h = 0; h < CPWM_NUM_PWM; h++) {
+		pwm = cpwm->pwms + h;
+		ret = platform_get_irq_optional(pdev, h);
+		if (ret == -EPROBE_DEFER)
+			goto unregister_clk_notifiers;
+		if (ret <= 0)
+			continue;
+
+		pwm->irq = ret;
+		ret = devm_request_irq(&pdev->dev, pwm->irq, cadence_pwm_irq,
+				       0, dev_name(&pdev->dev), pwm);
+		if (ret) {
+			dev_err(&pdev->dev,
+				"cannot request interrupt of counter %d", h);
+			goto unregister_clk_notifiers;
+		}
+		pwm->dither = of_property_read_bool(pdev->dev.of_node,
+						    "cdns,dither");
 	}
 
-	cpwm->chip.dev = &pdev->dev;
 	cpwm->chip.ops = &cadence_pwm_ops;
 	cpwm->chip.npwm = CPWM_NUM_PWM;
 	cpwm->chip.base = -1;
@@ -336,12 +2464,30 @@ static int cadence_pwm_probe(struct platform_device *pdev)
 	ret = pwmchip_add(&cpwm->chip);
 	if (ret < 0) {
 		dev_err(&pdev->dev, "cannot add pwm chip (error %d)", ret);
-		goto disable_system_clk;
+		goto unregister_clk_notifiers;
 	}
 
-	platform_set_drvdata(pdev, cpwm);
+	cpwm->miscdev.minor = MISC_DYNAMIC_MINOR;
+	cpwm->miscdev.name = devm_kasprintf(&pdev->dev, GFP_KERNEL, "%s-%s",
+					    DRIVER_NAME, dev_name(&pdev->dev));
+	cpwm->miscdev.fops = &cadence_pwm_misc_fops;
+	cpwm->miscdev.parent = &pdev->dev;
+	ret = cpwm->miscdev.name ? misc_register(&cpwm->miscdev) : -ENOMEM;
+	if (ret) {
+		dev_err(&pdev->dev, "cannot add query device (error %d)", ret);
+		goto remove_chip;
+	}
+
+	cadence_pwm_debugfs_init(cpwm);
 	return 0;
 
+remove_chip:
+	pwmchip_remove(&cpwm->chip);
+unregister_clk_notifiers:
+	while (i--)
+		clk_notifier_unregister(cpwm->pwms[i].clk,
+					&cpwm->pwms[i].clk_nb);
+	clk_notifier_unregister(cpwm->system_clk, &cpwm->system_clk_nb);
 disable_system_clk:
 	clk_disable_unprepare(cpwm->system_clk);
 	return ret;
@@ -352,26 +2498,63 @@ static int cadence_pwm_remove(struct platform_device *pdev)
 	struct cadence_pwm_chip *cpwm = platform_get_drvdata(pdev);
 	int i;
 
+	debugfs_remove_recursive(cpwm->debugfs);
+	misc_deregister(&cpwm->miscdev);
+
 	for (i = 0; i < cpwm->chip.npwm; i++)
 		pwm_disable(&cpwm->chip.pwms[i]);
 
+	for (i = 0; i < CPWM_NUM_PWM; i++)
+		clk_notifier_unregister(cpwm->pwms[i].clk,
+					&cpwm->pwms[i].clk_nb);
+	clk_notifier_unregister(cpwm->system_clk, &cpwm->system_clk_nb);
+
 	clk_disable_unprepare(cpwm->system_clk);
 
 	return pwmchip_remove(&cpwm->chip);
 }
 
 static const struct of_device_id cadence_pwm_of_match[] = {
-	{ .compatible = "cdns,ttcpwm" },
+	{ .compatible = "cdns,ttcpwm", .data = &cadence_pwm_zynq },
+	{ .compatible = "xlnx,zynqmp-ttcpwm", .data = &cadence_pwm_zynqmp },
 	{},
 };
 
 MODULE_DEVICE_TABLE(of, cadence_pwm_of_match);
 
+static int __maybe_unused cadence_pwm_suspend(struct device *dev)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+
+	cpwm_regs_suspend(cpwm);
+	clk_disable_unprepare(cpwm->system_clk);
+	return 0;
+}
+
+static int __maybe_unused cadence_pwm_resume(struct device *dev)
+{
+	struct cadence_pwm_chip *cpwm = dev_get_drvdata(dev);
+	int ret;
+
+	ret = clk_prepare_enable(cpwm->system_clk);
+	if (ret) {
+		dev_err(dev, "Can't enable device clock.\n");
+		return ret;
+	}
+
+	return cpwm_regs_resume(cpwm);
+}
+
+static SIMPLE_DEV_PM_OPS(cadence_pwm_pm_ops, cadence_pwm_suspend,
+			 cadence_pwm_resume);
+
 static struct platform_driver cadence_pwm_driver = {
 	.driver = {
 		.name = "pwm-cadence",
 		.owner = THIS_MODULE,
 		.of_match_table = cadence_pwm_of_match,
+		.pm = &cadence_pwm_pm_ops,
+		.dev_groups = cadence_pwm_groups,
 	},
 	.probe = cadence_pwm_probe,
 	.remove = cadence_pwm_remove,
@@ -382,13 +2565,17 @@ static int __init cadence_pwm_init(void)
 	int ret;
 
 	printk(KERN_INFO "cadence_pwm init");
+	cadence_pwm_debugfs_root = debugfs_create_dir(DRIVER_NAME, NULL);
 	ret = platform_driver_register(&cadence_pwm_driver);
+	if (ret)
+		debugfs_remove_recursive(cadence_pwm_debugfs_root);
 	return ret;
 }
 
 static void __exit cadence_pwm_exit(void)
 {
 	platform_driver_unregister(&cadence_pwm_driver);
+	debugfs_remove_recursive(cadence_pwm_debugfs_root);
 }
 
 module_init(cadence_pwm_init);
@@ -0,0 +1,116 @@
+/* pwm-cadence.h
+ *
+ * Definitions shared by the Cadence Triple Timer Counter (TTC) PWM driver and
+ * its userspace tools
+ *
+ * Copyright (C) 2015 Xiphos Systems Corporation.
+ * Copyright (C) 2021 Fastree3D
+ * Licensed under the GPL-2 or later.
+ */
+
+#ifndef _PWM_CADENCE_H
+#define _PWM_CADENCE_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* Register description (from section 8.5) */
+
+enum cpwm_register {
+	CPWM_CLK_CTRL = 0,
+	CPWM_COUNTER_CTRL = 1,
+	CPWM_COUNTER_VALUE = 2,
+	CPWM_INTERVAL_COUNTER = 3,
+	CPWM_MATCH_1_COUNTER = 4,
+	CPWM_MATCH_2_COUNTER = 5,
+	CPWM_MATCH_3_COUNTER = 6,
+	CPWM_INTERRUPT_REGISTER = 7,
+	CPWM_INTERRUPT_ENABLE = 8,
+	CPWM_EVENT_CONTROL_TIMER = 9,
+	CPWM_EVENT_REGISTER = 10
+};
+
+#define CPWM_NUM_REGISTERS 11
+
+static const char *const cpwm_register_names[] = {
+	[CPWM_CLK_CTRL] = "CLK_CTRL",
+	[CPWM_COUNTER_CTRL] = "COUNTER_CTRL",
+	[CPWM_COUNTER_VALUE] = "COUNTER_VALUE",
+	[CPWM_INTERVAL_COUNTER] = "INTERVAL_COUNTER",
+	[CPWM_MATCH_1_COUNTER] = "MATCH_1_COUNTER",
+	[CPWM_MATCH_2_COUNTER] = "MATCH_2_COUNTER",
+	[CPWM_MATCH_3_COUNTER] = "MATCH_3_COUNTER",
+	[CPWM_INTERRUPT_REGISTER] = "INTERRUPT_REGISTER",
+	[CPWM_INTERRUPT_ENABLE] = "INTERRUPT_ENABLE",
+	[CPWM_EVENT_CONTROL_TIMER] = "EVENT_CONTROL_TIMER",
+	[CPWM_EVENT_REGISTER] = "EVENT_REGISTER",
+};
+
+/* Register access log, read from debugfs as a stream of these records in
+ * host byte order, oldest first. */
+
+#define CPWM_LOG_WRITE 0x1 // write access, read otherwise
+
+struct cpwm_log_record {
+	__u64 timestamp; // ns, local_clock() of the CPU doing the access
+	__u32 value;
+	__u8 pwm;
+	__u8 reg; // enum cpwm_register
+	__u8 flags; // CPWM_LOG_*
+	__u8 reserved;
+};
+
+/* Queries on the misc device /dev/pwm-cadence-<device>. Nothing is
+ * programmed, the answers are derived from the current counter clock rate. */
+
+#define CPWM_NUM_PRESCALERS 17 // clock divided by 2^0 to 2^16
+
+/* A counter with a dedicated clock can also count the system clock. The
+ * period range covers both, tick_ps is of the counter's own clock. Without a
+ * dedicated clock, rate and system_rate are the same. */
+struct cpwm_range {
+	__u32 pwm; // in: counter
+	__u32 rate; // counter's own clock, Hz
+	__u32 counter_bits;
+	__u32 system_rate; // system clock, Hz
+	__u64 period_min_ns;
+	__u64 period_max_ns;
+	__u64 tick_ps[CPWM_NUM_PRESCALERS]; // tick duration at each prescaler
+};
+
+struct cpwm_resolution {
+	__u32 pwm; // in: counter
+	__u32 prescaler; // log2 of the clock division used for period_ns
+	__u64 period_ns; // in
+	__u64 step_ps; // duty cycle step
+	__u32 steps; // duty cycle steps in a period
+	__u32 bits; // duty cycle resolution, log2 of steps + 1 rounded down
+};
+
+/* What config would program for a request. Entries are rounded one by one
+ * against the counter's current clock rate and rounding policy, as if each
+ * was the only one. */
+struct cpwm_round {
+	__u32 pwm; // in: counter
+	__s32 status; // 0, or -ERANGE when the period does not fit
+	__u64 period_ns; // in: requested, out: programmed
+	__u64 duty_ns; // in: requested, out: programmed
+	__u32 prescaler; // log2 of the clock division
+	__u32 interval; // INTERVAL_COUNTER value
+	__u32 match; // MATCH_1_COUNTER value
+	__u32 external; // counts the dedicated clock rather than the system clock
+};
+
+struct cpwm_round_batch {
+	__u64 requests; // pointer to count struct cpwm_round, updated in place
+	__u32 count;
+	__u32 reserved;
+};
+
+#define CPWM_IOC_MAGIC 0xcd
+
+#define CPWM_IOC_RANGE _IOWR(CPWM_IOC_MAGIC, 0, struct cpwm_range)
+#define CPWM_IOC_RESOLUTION _IOWR(CPWM_IOC_MAGIC, 1, struct cpwm_resolution)
+#define CPWM_IOC_ROUND _IOW(CPWM_IOC_MAGIC, 2, struct cpwm_round_batch)
+
+#endif /* _PWM_CADENCE_H */
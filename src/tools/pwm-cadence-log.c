@@ -0,0 +1,65 @@
+/* pwm-cadence-log.c
+ *
+ * Decoder for the register access log of the Cadence TTC PWM driver, as read
+ * from debugfs pwm-cadence/<device>/mmio_log
+ *
+ * Copyright (C) 2021 Fastree3D
+ * Licensed under the GPL-2 or later.
+ *
+ * Usage: pwm-cadence-log [FILE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pwm-cadence.h"
+
+#define NUM_REGISTER_NAMES \
+	(sizeof(cpwm_register_names) / sizeof(cpwm_register_names[0]))
+
+static void print_record(const struct cpwm_log_record *rec)
+{
+	const char *name = "?";
+
+	if (rec->reg < NUM_REGISTER_NAMES)
+		name = cpwm_register_names[rec->reg];
+
+	printf("%llu.%09llu pwm%u %c %-19s %08x\n",
+	       (unsigned long long)(rec->timestamp / 1000000000),
+	       (unsigned long long)(rec->timestamp % 1000000000), rec->pwm,
+	       rec->flags & CPWM_LOG_WRITE ? 'W' : 'R', name, rec->value);
+}
+
+int main(int argc, char **argv)
+{
+	struct cpwm_log_record rec;
+	FILE *f = stdin;
+	size_t n;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [FILE]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc == 2) {
+		f = fopen(argv[1], "rb");
+		if (!f) {
+			fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	while ((n = fread(&rec, 1, sizeof(rec), f)) == sizeof(rec))
+		print_record(&rec);
+
+	if (ferror(f)) {
+		fprintf(stderr, "read error: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (n)
+		fprintf(stderr, "ignoring %zu trailing bytes\n", n);
+
+	return EXIT_SUCCESS;
+}
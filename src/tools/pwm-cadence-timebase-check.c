@@ -0,0 +1,221 @@
+/* pwm-cadence-timebase-check.c
+ *
+ * Checks the driver's division-free ns to ticks conversion against exact
+ * division, near every power of two tick boundary and at random points of
+ * each prescaler's range, for 16 and 32 bit counters over the whole range of
+ * counter clock rates. Run by make check.
+ *
+ * Copyright (C) 2021 Fastree3D
+ * Licensed under the GPL-2 or later.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* What pwm-cadence-timebase.h takes from the kernel. The multiplications
+ * follow the generic versions in linux/math64.h, which 32-bit ARM uses, with
+ * their limits: mul_u64_u32_shr() only shifts by up to 32. */
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define BIT(n) (1UL << (n))
+#define BIT_ULL(n) (1ULL << (n))
+#define U64_MAX UINT64_MAX
+
+static int ilog2(u64 x)
+{
+	return 63 - __builtin_clzll(x);
+}
+
+static int fls(u32 x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder)
+{
+	*remainder = dividend % divisor;
+	return dividend / divisor;
+}
+
+static u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static u64 div64_u64_rem(u64 dividend, u64 divisor, u64 *remainder)
+{
+	*remainder = dividend % divisor;
+	return dividend / divisor;
+}
+
+#define DIV64_U64_ROUND_UP(ll, d) (((ll) + (d) - 1) / (d))
+
+static u64 mul_u64_u32_shr(u64 a, u32 mul, unsigned int shift)
+{
+	u32 ah = a >> 32, al = a;
+	u64 ret;
+
+	if (shift > 32) {
+		fprintf(stderr, "mul_u64_u32_shr: shift %u\n", shift);
+		exit(2);
+	}
+
+	ret = (u64)al * mul >> shift;
+	if (ah)
+		ret += (u64)ah * mul << (32 - shift);
+	return ret;
+}
+
+static u64 mul_u64_u64_shr(u64 a, u64 b, unsigned int shift)
+{
+	u64 ll = (a & 0xffffffff) * (b & 0xffffffff);
+	u64 lh = (a & 0xffffffff) * (b >> 32);
+	u64 hl = (a >> 32) * (b & 0xffffffff);
+	u64 hh = (a >> 32) * (b >> 32);
+	u64 mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+	u64 lo = (mid << 32) | (ll & 0xffffffff);
+	u64 hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+
+	if (!shift)
+		return lo;
+	if (shift < 64)
+		return (hi << (64 - shift)) | (lo >> shift);
+	return hi >> (shift - 64);
+}
+
+#include "pwm-cadence-timebase.h"
+
+static unsigned long failures;
+static unsigned long checks;
+
+/* xorshift64, for a reproducible run */
+static u64 random_state = 0x2545f4914f6cdd1dULL;
+
+static u64 random_u64(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+/* floor(ns * rate / NSEC_PER_SEC) and its remainder, by exact division */
+static u64 exact_ticks(u64 ns, u32 rate, u32 *rem)
+{
+	u64 q = ns / CPWM_NSEC_PER_SEC, r = ns % CPWM_NSEC_PER_SEC;
+
+	*rem = r * rate % CPWM_NSEC_PER_SEC;
+	return q * rate + r * rate / CPWM_NSEC_PER_SEC;
+}
+
+/* Smallest ns that converts to at least ticks, or U64_MAX past the range */
+static u64 exact_ns(u64 ticks, u32 rate)
+{
+	u64 q = ticks / rate, r = ticks % rate;
+
+	if (q > (U64_MAX - CPWM_NSEC_PER_SEC) / CPWM_NSEC_PER_SEC)
+		return U64_MAX;
+	return q * CPWM_NSEC_PER_SEC +
+	       (r * CPWM_NSEC_PER_SEC + rate - 1) / rate;
+}
+
+static void check_ns(const struct cadence_pwm_timebase *tb, u64 ns)
+{
+	u32 rem, exact_rem;
+	u64 ticks, exact;
+	int p;
+
+	if (ns >= tb->period_limit_ns[CPWM_MAX_PRESCALER])
+		return;
+
+	checks++;
+	ticks = cpwm_ns_to_ticks(tb, ns, &rem);
+	exact = exact_ticks(ns, tb->rate, &exact_rem);
+	p = cpwm_prescaler(tb, ns);
+	if (ticks == exact && rem == exact_rem &&
+	    exact < BIT_ULL(tb->counter_bits + p) &&
+	    (!p || exact >= BIT_ULL(tb->counter_bits + p - 1)))
+		return;
+
+	if (failures++ < 20)
+		fprintf(stderr,
+			"%u bit, rate %" PRIu32 ", %" PRIu64 " ns: %" PRIu64
+			" ticks + %" PRIu32 " prescaler %d, exact %" PRIu64
+			" + %" PRIu32 "\n",
+			tb->counter_bits, tb->rate, ns, ticks, rem, p, exact,
+			exact_rem);
+}
+
+/* Both sides of the ns at which the count reaches ticks */
+static void check_ticks(const struct cadence_pwm_timebase *tb, u64 ticks)
+{
+	u64 ns = exact_ns(ticks, tb->rate);
+
+	if (ns == U64_MAX)
+		return;
+	if (ns)
+		check_ns(tb, ns - 1);
+	check_ns(tb, ns);
+	check_ns(tb, ns + 1);
+}
+
+static void check_rate(unsigned int counter_bits, u32 rate)
+{
+	struct cadence_pwm_timebase tb = { .counter_bits = counter_bits };
+	u64 ticks, limit;
+	int i, p;
+
+	cpwm_timebase_set(&tb, rate);
+
+	for (p = 0; p <= CPWM_MAX_PRESCALER; p++) {
+		ticks = BIT_ULL(counter_bits + p);
+
+		limit = exact_ns(ticks, rate);
+		checks++;
+		if (tb.period_limit_ns[p] != limit && failures++ < 20)
+			fprintf(stderr,
+				"%u bit, rate %" PRIu32 ": limit %d is %" PRIu64
+				" ns, exact %" PRIu64 "\n",
+				counter_bits, rate, p, tb.period_limit_ns[p],
+				limit);
+
+		check_ticks(&tb, ticks - 1);
+		check_ticks(&tb, ticks);
+		check_ticks(&tb, ticks + 1);
+		for (i = 0; i < 64; i++)
+			check_ticks(&tb,
+				    ticks / 2 + random_u64() % (ticks / 2));
+		for (i = 0; i < 64; i++)
+			check_ns(&tb, random_u64() % tb.period_limit_ns[p]);
+	}
+}
+
+static const u32 rates[] = {
+	1,	   32768,     1000000,	  33333333,   50000000,
+	99999999,  100000000, 111111111,  133333333,  166666666,
+	999999999, 1000000000, 1007000000, 1500000000, 2000000000,
+	4082654881U, 4294967295U,
+};
+
+int main(void)
+{
+	unsigned int counter_bits;
+	unsigned int i;
+
+	for (counter_bits = 16; counter_bits <= 32; counter_bits += 16) {
+		for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+			check_rate(counter_bits, rates[i]);
+		/* Log-uniform over 1 Hz to 4 GHz */
+		for (i = 0; i < 1024; i++)
+			check_rate(counter_bits,
+				   (random_u64() >> 32) >> (random_u64() % 32) |
+					   1);
+	}
+
+	printf("%lu checks, %lu failures\n", checks, failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}